@@ -1,11 +1,11 @@
 #include <websocket_client.h>
-#include <WebSocketClientImplCurl.h>
+#include <BasicWebSocketClient.h>
 using namespace ws;
-struct websocket_client_t : public WebSocketClientImplCurl
+struct websocket_client_t : public BasicWebSocketClient<websocket_client_t>
 {
     websocket_client_t() :conn_cb(NULL), recv_cb(NULL), opaque(NULL) {}
     virtual void OnConnect(ConnectResult result)override;
-    virtual void OnRecv(Message msg, bool fin) override;
+    void OnFrame(Message msg, bool fin);
 
     websocket_client_connect_callback conn_cb;
     websocket_client_receive_callback recv_cb;
@@ -26,11 +26,62 @@ void websocket_client_connect_server(websocket_client_t* client, const char* url
     client->Connect(url);
 }
 
-int websocket_client_send_sessage(websocket_client_t* client, websocket_message_t msg)
+int64_t websocket_client_send_sessage(websocket_client_t* client, websocket_message_t msg)
 {
     return client->Send(ws::Message((FrameType)msg.type, msg.data, msg.len));
 }
 
+int64_t websocket_client_send_stream(websocket_client_t* client, websocket_client_stream_read_callback read,
+                                     void* opaque, uint64_t len, websocket_frame_type_t type)
+{
+    return client->SendStream(read, opaque, len, (FrameType)type);
+}
+
+int64_t websocket_client_send_file(websocket_client_t* client, const char* path)
+{
+    return client->SendFile(path);
+}
+
+void websocket_client_set_max_frame_size(websocket_client_t* client, size_t size)
+{
+    client->SetMaxFrameSize(size);
+}
+
+int websocket_client_set_capture_file(websocket_client_t* client, const char* path)
+{
+    return client->SetCaptureFile(path);
+}
+
+int websocket_client_set_transport(websocket_client_t* client, websocket_client_transport_t transport)
+{
+    return client->SetTransport((WebSocketClientImplCurl::Transport)transport);
+}
+
+void websocket_client_set_idle_timeout(websocket_client_t* client, unsigned milliseconds)
+{
+    client->SetIdleTimeout(milliseconds);
+}
+
+void websocket_client_set_inbound_budget(websocket_client_t* client, uint64_t max_bytes, uint64_t max_frames)
+{
+    client->SetInboundBudget(max_bytes, max_frames);
+}
+
+void websocket_client_release_inbound(websocket_client_t* client, uint64_t bytes)
+{
+    client->ReleaseInbound(bytes);
+}
+
+void websocket_client_set_tls_session_sharing(websocket_client_t* client, int enable)
+{
+    client->SetTlsSessionSharing(enable != 0);
+}
+
+int websocket_client_set_kernel_tls(websocket_client_t* client, int enable)
+{
+    return client->SetKernelTls(enable != 0);
+}
+
 void websocket_client_set_callbacks(
     websocket_client_t* client,
     websocket_client_connect_callback conn_cb,
@@ -48,7 +99,7 @@ void websocket_client_t::OnConnect(ConnectResult result)
         this->conn_cb((websocket_client_connect_result_t)result, this->opaque);
 }
 
-void websocket_client_t::OnRecv(Message msg, bool fin)
+void websocket_client_t::OnFrame(Message msg, bool fin)
 {
     if (this->recv_cb)
     {
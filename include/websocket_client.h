@@ -1,4 +1,5 @@
 #pragma once
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef WEBSOCKET_CLIENT_STATIC
@@ -60,7 +61,7 @@ typedef struct websocket_message_t
 {
     websocket_frame_type_t type;
     const char* data;
-    int len; // size of data in bytes
+    size_t len; // size of data in bytes
 }websocket_message_t;
 
 typedef enum websocket_client_connect_result_t
@@ -70,12 +71,23 @@ typedef enum websocket_client_connect_result_t
     Reject = 2
 } websocket_client_connect_result_t;
 
+typedef enum websocket_client_transport_t
+{
+    TransportCurl = 0,
+    TransportSocket = 1,
+    TransportIoUring = 2,
+    TransportIoUringSqPoll = 3,
+    TransportCurlWebSocket = 4
+} websocket_client_transport_t;
+
 typedef struct websocket_client_t websocket_client_t;
 
 typedef void (*websocket_client_connect_callback)(websocket_client_connect_result_t result, void* opaque);
 
 typedef void (*websocket_client_receive_callback)(websocket_message_t msg, int fin, void* opaque);
 
+typedef size_t (*websocket_client_stream_read_callback)(char* buffer, size_t size, void* opaque);
+
 /**
  * @brief create a websocket client instance
  * @return websocket client instance
@@ -121,7 +133,104 @@ WEBSOCKET_CLIENT_API void websocket_client_connect_server(websocket_client_t* cl
  * until it returns 0 or -1. The em msg will be buffed, you don't have to pass it again. Before finish sending the
  * last message, new messages won't be sent.
  */
-WEBSOCKET_CLIENT_API int websocket_client_send_sessage(websocket_client_t* client, websocket_message_t msg);
+WEBSOCKET_CLIENT_API int64_t websocket_client_send_sessage(websocket_client_t* client, websocket_message_t msg);
+
+/**
+ * @brief send a message whose payload is pulled from @em read, as a fragmented message
+ * @param client websocket client instance
+ * @param read callback to fetch the next piece of payload, returns the bytes filled and 0 at the end
+ * @param opaque private pointer for @em read
+ * @param len total payload size in bytes
+ * @param type frame type of the message
+ * @return same as @anchor websocket_client_send_sessage, and -1 if another message is still being sent.
+ * @note Each fragment is read, masked and sent on its own, so memory usage does not depend on @em len.
+ * Call @anchor websocket_client_send_sessage again to send the remaining fragments, @em read is invoked from there.
+ */
+WEBSOCKET_CLIENT_API int64_t websocket_client_send_stream(websocket_client_t* client,
+                                                          websocket_client_stream_read_callback read,
+                                                          void* opaque, uint64_t len, websocket_frame_type_t type);
+
+/**
+ * @brief send the content of a file as a fragmented binary message
+ * @param client websocket client instance
+ * @param path path of the file to send
+ * @return same as @anchor websocket_client_send_stream, and -1 if the file cannot be opened.
+ */
+WEBSOCKET_CLIENT_API int64_t websocket_client_send_file(websocket_client_t* client, const char* path);
+
+/**
+ * @brief set the maximum payload size of an outgoing frame
+ * @param client websocket client instance
+ * @param size maximum payload bytes per frame, 0 means messages are never fragmented (the default)
+ * @note Larger messages are sent as a series of continuation frames, and ping/pong frames passed to
+ * @anchor websocket_client_send_sessage meanwhile are sent between two fragments.
+ */
+WEBSOCKET_CLIENT_API void websocket_client_set_max_frame_size(websocket_client_t* client, size_t size);
+
+/**
+ * @brief record the raw inbound byte stream into a file, for replaying it later
+ * @param client websocket client instance
+ * @param path capture file to create, NULL stops capturing
+ * @return 1 on success, 0 if the file cannot be created
+ * @note Call this function before @anchor websocket_client_connect_server. See test/replay for the file format.
+ */
+WEBSOCKET_CLIENT_API int websocket_client_set_capture_file(websocket_client_t* client, const char* path);
+
+/**
+ * @brief select how the connection is driven once the handshake has completed
+ * @param client websocket client instance
+ * @param transport @em TransportCurl (default), or let the client read the socket itself with recv() and poll()
+ * (@em TransportSocket) or io_uring (@em TransportIoUring, @em TransportIoUringSqPoll, Linux only), or leave the
+ * whole protocol to the WebSocket API of libcurl (@em TransportCurlWebSocket, which can also send on wss://)
+ * @return 1 on success, 0 if @em transport is not supported by this build or libcurl
+ * @note Call this function before @anchor websocket_client_connect_server. wss:// connections use
+ * @em TransportCurl, unless @em TransportCurlWebSocket is selected.
+ */
+WEBSOCKET_CLIENT_API int websocket_client_set_transport(websocket_client_t* client, websocket_client_transport_t transport);
+
+/**
+ * @brief release the buffers of the connection after it has been quiet for a while
+ * @param client websocket client instance
+ * @param milliseconds time without inbound data before the buffers are released, 0 never releases them (default)
+ * @note Call this function before @anchor websocket_client_connect_server. Only the transports other than
+ * @em TransportCurl hibernate.
+ */
+WEBSOCKET_CLIENT_API void websocket_client_set_idle_timeout(websocket_client_t* client, unsigned milliseconds);
+
+/**
+ * @brief limit how much received data the application may hold before the client stops reading
+ * @param client websocket client instance
+ * @param max_bytes payload bytes received and not released yet, 0 means no limit
+ * @param max_frames frames received and not released yet, 0 means no limit
+ * @note Reading resumes when both counts are at or below half of their limit. With a limit set, release every
+ * received frame by @anchor websocket_client_release_inbound.
+ */
+WEBSOCKET_CLIENT_API void websocket_client_set_inbound_budget(websocket_client_t* client, uint64_t max_bytes,
+                                                              uint64_t max_frames);
+
+/**
+ * @brief report that the application is done with a received frame
+ * @param client websocket client instance
+ * @param bytes payload size of the frame
+ */
+WEBSOCKET_CLIENT_API void websocket_client_release_inbound(websocket_client_t* client, uint64_t bytes);
+
+/**
+ * @brief share TLS sessions with the other clients of this process, so reconnecting resumes the session
+ * @param client websocket client instance
+ * @param enable 1 to share (default), 0 to keep a private session cache
+ */
+WEBSOCKET_CLIENT_API void websocket_client_set_tls_session_sharing(websocket_client_t* client, int enable);
+
+/**
+ * @brief let the kernel encrypt and decrypt the TLS records of wss:// connections (kTLS)
+ * @param client websocket client instance
+ * @param enable 1 to request kTLS
+ * @return 1 on success, 0 if this build does not support it
+ * @note Call this function before @anchor websocket_client_connect_server. Sending on a wss:// connection needs
+ * kTLS to be active for outgoing records.
+ */
+WEBSOCKET_CLIENT_API int websocket_client_set_kernel_tls(websocket_client_t* client, int enable);
 
 /**
  * @brief websocket_client_set_callbacks
@@ -0,0 +1,71 @@
+#pragma once
+#include "WebSocketClientImplCurl.h"
+
+namespace ws {
+
+    /**
+     * @brief Client which frames are dispatched to @em Handler at compile time.
+     *
+     * @em Handler derives from this class (CRTP) and defines
+     * @code
+     * void OnFrame(ws::Message msg, bool fin);
+     * @endcode
+     * which is called for every inbound frame instead of the virtual @em OnRecv(). Since the parser is
+     * instantiated for @em Handler, the call is resolved statically and can be inlined into the parsing loop;
+     * only one virtual call per received chunk remains. @em Options selects compile-time parser options, see
+     * @em FrameParserOptions.
+     *
+     * @code
+     * class Client : public ws::BasicWebSocketClient<Client>
+     * {
+     * public:
+     *     void OnFrame(ws::Message msg, bool fin) { ... }
+     * };
+     * @endcode
+     */
+    template <class Handler, class Options = FrameParserOptions>
+    class BasicWebSocketClient : public WebSocketClientImplCurl
+    {
+    public:
+        BasicWebSocketClient() {}
+        BasicWebSocketClient(const char** customHeader, int nlines) : WebSocketClientImplCurl(customHeader, nlines) {}
+
+        virtual size_t ParseInbound(const char* data, size_t datalen) override
+        {
+            Handler* handler = static_cast<Handler*>(this);
+            return m_parser.Parse(data, datalen, [handler](Message msg, bool fin) {
+                handler->CountInbound(msg.len);
+                handler->StampInbound(msg);
+                handler->PublishInbound(msg, fin);
+                WS_TRACE_SCOPE(dispatch, msg.len);
+                handler->OnFrame(msg, fin);
+            });
+        }
+
+        virtual void DispatchInbound(Message msg, bool fin) override
+        {
+            if (Options::binaryOnly && msg.type != Binary && msg.type != Continuation)
+                return;
+            Handler* handler = static_cast<Handler*>(this);
+            handler->CountInbound(msg.len);
+            handler->StampInbound(msg);
+            handler->PublishInbound(msg, fin);
+            WS_TRACE_SCOPE(dispatch, msg.len);
+            handler->OnFrame(msg, fin);
+        }
+
+        virtual void ResetInbound() override
+        {
+            m_parser.Reset();
+        }
+
+        virtual void CompactInbound() override
+        {
+            m_parser.Compact();
+        }
+
+    private:
+        FrameParser<Options> m_parser;
+    };
+
+}
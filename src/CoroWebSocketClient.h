@@ -0,0 +1,338 @@
+#pragma once
+#include "BasicWebSocketClient.h"
+
+// Needs C++20 coroutines and poll() on a pipe, i.e. a POSIX system.
+#if defined(__cpp_impl_coroutine) && !defined(_WIN32)
+
+#include <coroutine>
+#include <deque>
+#include <errno.h>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+namespace ws {
+
+    /**
+     * @brief Coroutine type for functions which @em co_await a @em CoroWebSocketClient.
+     *
+     * The coroutine starts running when called and its frame is freed when it returns, nobody awaits it.
+     */
+    struct Task
+    {
+        struct promise_type
+        {
+            Task get_return_object() { return Task(); }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+        };
+    };
+
+    /**
+     * @brief Waits for sockets to become writable and finishes the sends suspended on them.
+     *
+     * One thread serves all clients of the process, it only runs while a send is waiting for the socket buffer.
+     */
+    class SendPoller
+    {
+    public:
+        static SendPoller& Instance()
+        {
+            static SendPoller* poller = new SendPoller;  // never destroyed, its thread runs until exit
+            return *poller;
+        }
+
+        /**
+         * @brief Call @em step(opaque) each time @em fd is writable, until it returns 0 or -1, then store the
+         * result into @em result and resume @em handle.
+         */
+        void Add(int fd, int64_t (*step)(void*), void* opaque, std::coroutine_handle<> handle, int64_t* result)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_waiters.push_back(Waiter { fd, step, opaque, handle, result });
+            }
+            char c = 0;
+            while (write(m_wake[1], &c, 1) < 0 && errno == EINTR)
+                ;
+        }
+
+    private:
+        struct Waiter
+        {
+            int fd;
+            int64_t (*step)(void*);
+            void* opaque;
+            std::coroutine_handle<> handle;
+            int64_t* result;
+        };
+
+        SendPoller()
+        {
+            if (pipe(m_wake) != 0)
+                throw "create pipe failed";
+            fcntl(m_wake[0], F_SETFL, O_NONBLOCK);
+            std::thread(&SendPoller::Run, this).detach();
+        }
+
+        void Run()
+        {
+            std::vector<Waiter> waiters;
+            std::vector<pollfd> fds;
+            for (;;)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    waiters = m_waiters;
+                }
+                fds.resize(waiters.size() + 1);
+                fds[0].fd = m_wake[0];
+                fds[0].events = POLLIN;
+                for (size_t i = 0; i < waiters.size(); ++i)
+                {
+                    fds[i + 1].fd = waiters[i].fd;
+                    fds[i + 1].events = POLLOUT;
+                }
+                if (poll(fds.data(), fds.size(), -1) < 0)
+                    continue;
+                if (fds[0].revents)
+                {
+                    char buf[64];
+                    while (read(m_wake[0], buf, sizeof(buf)) > 0)
+                        ;
+                }
+                for (size_t i = 0; i < waiters.size(); ++i)
+                {
+                    if (!fds[i + 1].revents)
+                        continue;
+                    int64_t remaining = waiters[i].step(waiters[i].opaque);
+                    if (remaining > 0)
+                        continue;
+                    {
+                        std::lock_guard<std::mutex> lock(m_mutex);
+                        for (size_t j = 0; j < m_waiters.size(); ++j)
+                        {
+                            if (m_waiters[j].handle == waiters[i].handle)
+                            {
+                                m_waiters.erase(m_waiters.begin() + j);
+                                break;
+                            }
+                        }
+                    }
+                    *waiters[i].result = remaining;
+                    waiters[i].handle.resume();
+                }
+            }
+        }
+
+        int m_wake[2];
+        std::mutex m_mutex;
+        std::vector<Waiter> m_waiters;
+    };
+
+    /**
+     * @brief Client driven by C++20 coroutines.
+     *
+     * @code
+     * ws::Task Run(ws::CoroWebSocketClient& client)
+     * {
+     *     if (co_await client.Connect("http://127.0.0.1:8000/ws") != ws::WebSocketClientImplCurl::Success)
+     *         co_return;
+     *     co_await client.Send(ws::Message(ws::Text, "hello", 5));
+     *     while (std::optional<ws::CoroWebSocketClient::Frame> frame = co_await client.Recv())
+     *         ...
+     * }
+     * @endcode
+     *
+     * No thread is started per operation: an awaiting coroutine is resumed on the thread of the client which
+     * completes the operation, the connection thread for @em Connect() and @em Recv(), and the thread of
+     * @em SendPoller for a @em Send() which had to wait for the socket. Operations that can complete at once
+     * do not suspend. At most one coroutine may await @em Recv(), and one @em Send(), at a time.
+     * @note Do not destroy the client from a coroutine resumed by it.
+     */
+    class CoroWebSocketClient : public BasicWebSocketClient<CoroWebSocketClient>
+    {
+    public:
+        /**
+         * @brief A received frame, owning its payload.
+         */
+        struct Frame
+        {
+            FrameType type;
+            std::string data;
+            bool fin;
+        };
+
+        CoroWebSocketClient() : m_connectResult(NULL), m_recvFrame(NULL), m_closed(true) {}
+        CoroWebSocketClient(const char** customHeader, int nlines)
+            : BasicWebSocketClient<CoroWebSocketClient>(customHeader, nlines)
+            , m_connectResult(NULL), m_recvFrame(NULL), m_closed(true) {}
+
+        struct ConnectAwaiter
+        {
+            CoroWebSocketClient* client;
+            const char* url;
+            ConnectResult result;
+
+            bool await_ready() { return false; }
+            void await_suspend(std::coroutine_handle<> handle)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(client->m_mutex);
+                    client->m_connectWaiter = handle;
+                    client->m_connectResult = &result;
+                    client->m_closed = false;
+                    client->m_frames.clear();
+                }
+                // The coroutine may be resumed on the connection thread before Connect() returns.
+                client->WebSocketClientImplCurl::Connect(url);
+            }
+            ConnectResult await_resume() { return result; }
+        };
+
+        struct RecvAwaiter
+        {
+            CoroWebSocketClient* client;
+            std::optional<Frame> frame;
+
+            bool await_ready() { return false; }
+            bool await_suspend(std::coroutine_handle<> handle)
+            {
+                std::lock_guard<std::mutex> lock(client->m_mutex);
+                if (!client->m_frames.empty())
+                {
+                    frame = std::move(client->m_frames.front());
+                    client->m_frames.pop_front();
+                    return false;
+                }
+                if (client->m_closed)
+                    return false;
+                client->m_recvWaiter = handle;
+                client->m_recvFrame = &frame;
+                return true;
+            }
+            std::optional<Frame> await_resume() { return std::move(frame); }
+        };
+
+        struct SendAwaiter
+        {
+            CoroWebSocketClient* client;
+            Message msg;
+            int64_t result;
+            bool taken;
+
+            // Flush a message still in flight before taking msg, then send the rest of msg.
+            int64_t Step()
+            {
+                if (taken)
+                    return client->SendRemaining();
+                int64_t remaining;
+                do
+                    remaining = client->WebSocketClientImplCurl::Send(msg, taken);
+                while (!taken && remaining == 0);
+                return remaining;
+            }
+            static int64_t Step(void* opaque) { return static_cast<SendAwaiter*>(opaque)->Step(); }
+
+            bool await_ready()
+            {
+                result = Step();
+                return result <= 0;
+            }
+            void await_suspend(std::coroutine_handle<> handle)
+            {
+                SendPoller::Instance().Add((int)client->GetSocket(), &SendAwaiter::Step, this, handle, &result);
+            }
+            int64_t await_resume() { return result; }
+        };
+
+        /**
+         * @brief Connect to websocket server.
+         * @return awaitable giving the @em ConnectResult
+         */
+        ConnectAwaiter Connect(const char* url)
+        {
+            return ConnectAwaiter { this, url, Reject };
+        }
+
+        /**
+         * @brief Receive the next frame.
+         * @return awaitable giving the frame, or no value once the connection is closed and all frames were read
+         */
+        RecvAwaiter Recv()
+        {
+            return RecvAwaiter { this, std::nullopt };
+        }
+
+        /**
+         * @brief Send a message, suspending while the socket buffer is full.
+         *
+         * A message still in flight from a plain @em SendRemaining() caller is finished first.
+         * @return awaitable giving 0 once the whole message was sent, or -1 if it was not
+         */
+        SendAwaiter Send(Message msg)
+        {
+            return SendAwaiter { this, msg, 0, false };
+        }
+
+        virtual void OnConnect(ConnectResult result) override
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            std::coroutine_handle<> handle = m_connectWaiter;
+            if (!handle)
+                return;     // a Reject reported after the connection ended, OnDisconnect() handles it
+            m_connectWaiter = nullptr;
+            *m_connectResult = result;
+            if (result != Success)
+                m_closed = true;
+            lock.unlock();
+            handle.resume();
+        }
+
+        void OnFrame(Message msg, bool fin)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (!m_recvWaiter)
+            {
+                m_frames.push_back(Frame { msg.type, std::string(msg.data, msg.len), fin });
+                return;
+            }
+            std::coroutine_handle<> handle = m_recvWaiter;
+            m_recvWaiter = nullptr;
+            *m_recvFrame = Frame { msg.type, std::string(msg.data, msg.len), fin };
+            lock.unlock();
+            handle.resume();
+        }
+
+        virtual void OnDisconnect() override
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_closed = true;
+            std::coroutine_handle<> handle = m_recvWaiter;
+            m_recvWaiter = nullptr;
+            lock.unlock();
+            if (handle)
+                handle.resume();
+        }
+
+    private:
+        std::mutex m_mutex;
+        std::coroutine_handle<> m_connectWaiter;
+        ConnectResult* m_connectResult;
+        std::coroutine_handle<> m_recvWaiter;
+        std::optional<Frame>* m_recvFrame;
+        std::deque<Frame> m_frames;     // received while no coroutine was waiting
+        bool m_closed;
+    };
+
+}
+
+#endif // __cpp_impl_coroutine
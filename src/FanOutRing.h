@@ -0,0 +1,406 @@
+#pragma once
+#include "FrameParser.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#endif
+
+/*
+ * Shared-memory ring carrying the frames received by one client to any number of local consumer processes.
+ *
+ * The ring is a file, typically under /dev/shm: a header page followed by the records. One process writes it
+ * with @em FanOutWriter (see @em WebSocketClientImplCurl::SetFanOutRing()), consumers read it with
+ * @em FanOutReader, each at a cursor of its own. The writer never waits for the readers: one falling more than
+ * the ring capacity behind loses the frames overwritten meanwhile, and notices it. Reading takes no system call
+ * while there is data, an idle reader may sleep in @em FanOutReader::Wait(). Not supported on Windows.
+ */
+
+namespace ws {
+
+    struct FanOutRingHeader
+    {
+        char magic[8];                          // "WSFANOUT"
+        uint64_t capacity;                      // bytes of records, a power of two
+        uint64_t nextSeq;                       // sequence number of the next record, for a writer reopening the ring
+        char pad1[40];
+        std::atomic<uint64_t> intent;           // end of the record being written, set before writing it
+        char pad2[56];
+        std::atomic<uint64_t> tail;             // end of the records written, set after writing them
+        char pad3[56];
+        std::atomic<uint32_t> wakeSeq;          // futex readers sleep on, bumped by the writer to wake them
+        std::atomic<uint32_t> waiters;          // readers sleeping or about to
+    };
+
+    struct FanOutRecord
+    {
+        uint32_t len;           // payload bytes
+        uint8_t type;           // FrameType, or @em padding up to the end of the ring
+        uint8_t fin;
+        uint16_t reserved;
+        uint64_t seq;
+        uint64_t kernelTime;    // as in @em Message
+        uint64_t dispatchTime;
+    };
+
+    static const size_t fanOutHeaderSize = 4096;
+    static const uint8_t fanOutPadding = 0xFF;
+
+    /**
+     * @brief Write side of a fan-out ring, a single writer per ring.
+     */
+    class FanOutWriter
+    {
+    public:
+        FanOutWriter() : m_header(NULL), m_data(NULL), m_mask(0), m_mapped(0) {}
+        ~FanOutWriter()
+        {
+            Close();
+        }
+
+        /**
+         * @brief Create the ring file, or reopen it and continue after its last record.
+         * @param path file to map, e.g. /dev/shm/feed
+         * @param capacity bytes of records, rounded up to a power of two, an existing ring keeps its own
+         * @return false if the file cannot be created or mapped, or is not a fan-out ring
+         */
+        bool Open(const char* path, uint64_t capacity)
+        {
+            Close();
+#ifdef _WIN32
+            return false;
+#else
+            int fd = open(path, O_RDWR | O_CREAT, 0644);
+            if (fd < 0)
+                return false;
+            struct stat st;
+            FanOutRingHeader existing;
+            bool reopen = fstat(fd, &st) == 0 && (size_t)st.st_size >= fanOutHeaderSize &&
+                          pread(fd, &existing, sizeof(existing), 0) == (ssize_t)sizeof(existing) &&
+                          memcmp(existing.magic, "WSFANOUT", 8) == 0 &&
+                          (uint64_t)st.st_size == fanOutHeaderSize + existing.capacity;
+            if (reopen)
+            {
+                capacity = existing.capacity;
+            }
+            else
+            {
+                uint64_t size = 4096;
+                while (size < capacity)
+                    size <<= 1;
+                capacity = size;
+                if (ftruncate(fd, 0) != 0 || ftruncate(fd, fanOutHeaderSize + capacity) != 0)
+                {
+                    close(fd);
+                    return false;
+                }
+            }
+            size_t mapped = fanOutHeaderSize + capacity;
+            void* addr = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            close(fd);
+            if (addr == MAP_FAILED)
+                return false;
+            m_header = (FanOutRingHeader*)addr;
+            m_data = (char*)addr + fanOutHeaderSize;
+            m_mask = capacity - 1;
+            m_mapped = mapped;
+            if (!reopen)
+            {
+                // A new ring, the magic goes last so readers never see it half initialized.
+                m_header->capacity = capacity;
+                m_header->nextSeq = 0;
+                m_header->intent.store(0, std::memory_order_relaxed);
+                m_header->tail.store(0, std::memory_order_relaxed);
+                m_header->wakeSeq.store(0, std::memory_order_relaxed);
+                m_header->waiters.store(0, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+                memcpy(m_header->magic, "WSFANOUT", 8);
+            }
+            return true;
+#endif
+        }
+
+        void Close()
+        {
+#ifndef _WIN32
+            if (m_header)
+                munmap(m_header, m_mapped);
+#endif
+            m_header = NULL;
+            m_data = NULL;
+        }
+
+        bool IsOpen() const
+        {
+            return m_header != NULL;
+        }
+
+        /**
+         * @brief Append a frame, overwriting the oldest ones as needed.
+         * @return false if the frame is larger than the ring
+         */
+        bool Publish(const Message& msg, bool fin)
+        {
+            uint64_t capacity = m_mask + 1;
+            uint64_t recordLen = Align(sizeof(FanOutRecord) + msg.len);
+            if (recordLen > capacity)
+                return false;
+            uint64_t tail = m_header->tail.load(std::memory_order_relaxed);
+            uint64_t offset = tail & m_mask;
+            uint64_t padding = offset + recordLen > capacity ? capacity - offset : 0;  // records never wrap
+            uint64_t end = tail + padding + recordLen;
+
+            // Readers check the intent after copying a record, to detect it was overwritten meanwhile.
+            m_header->intent.store(end, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            if (padding >= sizeof(FanOutRecord))
+                ((FanOutRecord*)(m_data + offset))->type = fanOutPadding;
+            if (padding)
+                offset = 0;
+            FanOutRecord* record = (FanOutRecord*)(m_data + offset);
+            record->len = (uint32_t)msg.len;
+            record->type = (uint8_t)msg.type;
+            record->fin = fin;
+            record->reserved = 0;
+            record->seq = m_header->nextSeq++;
+            record->kernelTime = msg.kernelTime;
+            record->dispatchTime = msg.dispatchTime;
+            memcpy(record + 1, msg.data, msg.len);
+            m_header->tail.store(end, std::memory_order_release);
+
+            // Only a sleeping reader costs a system call, ordered against its check of the tail.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (m_header->waiters.load(std::memory_order_relaxed))
+            {
+                m_header->wakeSeq.fetch_add(1, std::memory_order_release);
+#ifdef __linux__
+                syscall(SYS_futex, &m_header->wakeSeq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+            }
+            return true;
+        }
+
+        static uint64_t Align(uint64_t len)
+        {
+            return (len + 7) & ~(uint64_t)7;
+        }
+
+    private:
+        FanOutRingHeader* m_header;
+        char* m_data;
+        uint64_t m_mask;
+        size_t m_mapped;
+    };
+
+    /**
+     * @brief Read side of a fan-out ring, one per consumer, the consumer library.
+     *
+     * Messages are copied out of the ring before they are handed over, and checked not to have been
+     * overwritten while copying, so a slow reader never sees a torn frame. Not thread-safe, each thread reading
+     * the ring opens a reader of its own.
+     */
+    class FanOutReader
+    {
+    public:
+        FanOutReader() : m_header(NULL), m_data(NULL), m_mask(0), m_cursor(0), m_nextSeq(0), m_started(false),
+                         m_lost(0) {}
+        ~FanOutReader()
+        {
+            Close();
+        }
+
+        /**
+         * @brief Map the ring written by another process, reading from its current end.
+         * @return false if the file cannot be mapped or is not a fan-out ring
+         */
+        bool Open(const char* path)
+        {
+            Close();
+#ifdef _WIN32
+            return false;
+#else
+            int fd = open(path, O_RDWR);
+            if (fd < 0)
+                return false;
+            FanOutRingHeader header;
+            struct stat st;
+            if (fstat(fd, &st) != 0 || pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+                memcmp(header.magic, "WSFANOUT", 8) != 0 ||
+                (uint64_t)st.st_size != fanOutHeaderSize + header.capacity)
+            {
+                close(fd);
+                return false;
+            }
+            // The header is written to sleep and wake, the records are only read.
+            void* head = mmap(NULL, fanOutHeaderSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            void* data = mmap(NULL, header.capacity, PROT_READ, MAP_SHARED, fd, fanOutHeaderSize);
+            close(fd);
+            if (head == MAP_FAILED || data == MAP_FAILED)
+            {
+                if (head != MAP_FAILED)
+                    munmap(head, fanOutHeaderSize);
+                if (data != MAP_FAILED)
+                    munmap(data, header.capacity);
+                return false;
+            }
+            m_header = (FanOutRingHeader*)head;
+            m_data = (const char*)data;
+            m_mask = header.capacity - 1;
+            m_cursor = m_header->tail.load(std::memory_order_acquire);
+            m_started = false;
+            m_lost = 0;
+            return true;
+#endif
+        }
+
+        void Close()
+        {
+#ifndef _WIN32
+            if (m_header)
+            {
+                munmap((void*)m_data, m_mask + 1);
+                munmap(m_header, fanOutHeaderSize);
+            }
+#endif
+            m_header = NULL;
+            m_data = NULL;
+        }
+
+        /**
+         * @brief Take the next message.
+         * @param msg set to the message, its data valid until the next call
+         * @param fin set to whether this data frame is a last frame
+         * @return false if there is no new message
+         */
+        bool Read(Message& msg, bool& fin)
+        {
+            uint64_t capacity = m_mask + 1;
+            for (;;)
+            {
+                uint64_t tail = m_header->tail.load(std::memory_order_acquire);
+                if (m_cursor == tail)
+                    return false;
+                if (tail - m_cursor > capacity)
+                {
+                    m_cursor = tail;    // lapped, go on with the newest frames
+                    continue;
+                }
+                uint64_t offset = m_cursor & m_mask;
+                if (capacity - offset < sizeof(FanOutRecord))
+                {
+                    m_cursor += capacity - offset;
+                    continue;
+                }
+                FanOutRecord record;
+                memcpy(&record, m_data + offset, sizeof(record));
+                size_t len = record.type == fanOutPadding ? 0 : record.len;
+                if (len > capacity - offset - sizeof(record))
+                    len = 0;    // garbage of a record being overwritten, caught below
+                m_copy.assign(m_data + offset + sizeof(record), len);
+
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (m_header->intent.load(std::memory_order_relaxed) - m_cursor > capacity)
+                {
+                    m_cursor = m_header->tail.load(std::memory_order_acquire);  // overwritten while copying
+                    continue;
+                }
+                if (record.type == fanOutPadding)
+                {
+                    m_cursor += capacity - offset;
+                    continue;
+                }
+                if (m_started && record.seq != m_nextSeq)
+                    m_lost += record.seq - m_nextSeq;
+                m_started = true;
+                m_nextSeq = record.seq + 1;
+                m_cursor += FanOutWriter::Align(sizeof(record) + record.len);
+
+                msg = Message((FrameType)record.type, m_copy.data(), m_copy.size());
+                msg.kernelTime = record.kernelTime;
+                msg.dispatchTime = record.dispatchTime;
+                fin = record.fin != 0;
+                return true;
+            }
+        }
+
+        /**
+         * @brief Read the new messages.
+         * @param onMessage called as @em onMessage(Message msg, bool fin) for every message
+         * @param max most messages to read, 0 for all
+         * @return number of messages read
+         */
+        template <class F>
+        size_t Poll(F&& onMessage, size_t max = 0)
+        {
+            size_t count = 0;
+            Message msg(Binary, NULL, 0);
+            bool fin;
+            while ((!max || count < max) && Read(msg, fin))
+            {
+                onMessage(msg, fin);
+                ++count;
+            }
+            return count;
+        }
+
+        /**
+         * @brief Sleep until a new message is there.
+         * @param milliseconds longest time to sleep, -1 for no limit
+         * @return true if a message is there
+         */
+        bool Wait(int milliseconds)
+        {
+            if (m_header->tail.load(std::memory_order_acquire) != m_cursor)
+                return true;
+#ifdef __linux__
+            uint32_t seq = m_header->wakeSeq.load(std::memory_order_acquire);
+            m_header->waiters.fetch_add(1, std::memory_order_seq_cst);
+            if (m_header->tail.load(std::memory_order_seq_cst) == m_cursor)
+            {
+                timespec timeout;
+                timeout.tv_sec = milliseconds / 1000;
+                timeout.tv_nsec = (milliseconds % 1000) * 1000000L;
+                syscall(SYS_futex, &m_header->wakeSeq, FUTEX_WAIT, seq, milliseconds >= 0 ? &timeout : NULL,
+                        NULL, 0);
+            }
+            m_header->waiters.fetch_sub(1, std::memory_order_relaxed);
+#else
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+#endif
+            return m_header->tail.load(std::memory_order_acquire) != m_cursor;
+        }
+
+        /**
+         * @brief Number of messages this reader missed because it fell more than the ring capacity behind.
+         */
+        uint64_t Lost() const
+        {
+            return m_lost;
+        }
+
+    private:
+        FanOutRingHeader* m_header;
+        const char* m_data;
+        uint64_t m_mask;
+        uint64_t m_cursor;      // ring position of the next record
+        uint64_t m_nextSeq;     // expected sequence number of the next record
+        bool m_started;
+        uint64_t m_lost;
+        std::string m_copy;
+    };
+
+}
@@ -0,0 +1,206 @@
+#pragma once
+#include "Trace.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+namespace ws {
+
+    enum FrameType
+    {
+        // Non-control frame.
+        Continuation = 0x0,
+        Text = 0x1,
+        Binary = 0x2,
+        NonControlReserved1 = 0x3,
+        NonControlReserved2 = 0x4,
+        NonControlReserved3 = 0x5,
+        NonControlReserved4 = 0x6,
+        NonControlReserved5 = 0x7,
+
+        // Control frame.
+        Close = 0x8,
+        Ping = 0x9,
+        Pong = 0xA,
+        ControlReserved1 = 0xB,
+        ControlReserved2 = 0xC,
+        ControlReserved3 = 0xD,
+        ControlReserved4 = 0xE,
+        ControlReserved5 = 0xF,
+    };
+
+
+
+    struct Message
+    {
+        Message(FrameType type, const char* data, size_t len)
+            :type(type), data(data), len(len), kernelTime(0), dispatchTime(0) {}
+        FrameType type;
+        const char* data;
+        size_t len; // size of data in bytes
+
+        // Receive timestamps in nanoseconds since the epoch, 0 unless enabled by @em SetReceiveTimestamps().
+        uint64_t kernelTime;    // the kernel received the last bytes of the frame
+        uint64_t dispatchTime;  // the frame was handed to the application
+    };
+
+    /**
+     * @brief Compile-time options of @em FrameParser.
+     *
+     * Derive from this struct and hide the members to change them, e.g.
+     * @code
+     * struct BinaryOptions : ws::FrameParserOptions { static const bool binaryOnly = true; };
+     * @endcode
+     */
+    struct FrameParserOptions
+    {
+        // Unmask frames the server masked, though RFC 6455 forbids it. When false such payloads are delivered as
+        // they are, which saves the check on every frame.
+        static const bool unmask = true;
+
+        // Deliver only Binary and Continuation frames, text and control frames are dropped.
+        static const bool binaryOnly = false;
+    };
+
+    /**
+     * @brief Split the inbound byte stream of a client into frames.
+     *
+     * Header-only so the frame callback can be inlined into the parsing loop. Complete frames are delivered
+     * straight from the chunk passed in, only a frame split across chunks is copied.
+     */
+    template <class Options = FrameParserOptions>
+    class FrameParser
+    {
+    public:
+        /**
+         * @brief Parse a chunk of the byte stream.
+         * @param onFrame called as @em onFrame(Message msg, bool fin) for every complete frame
+         * @return number of frames parsed
+         *
+         * The message data is valid until @em onFrame returns.
+         */
+        template <class F>
+        size_t Parse(const char* data, size_t len, F&& onFrame)
+        {
+            size_t frames = 0;
+            // Finish the frame left over from the last chunk, copying only its own bytes.
+            while (!m_partial.empty() && len)
+            {
+                Header header;
+                size_t take;
+                if (DecodeHeader(m_partial.data(), m_partial.size(), header))
+                    take = (size_t)(header.size + header.payloadlen - m_partial.size());
+                else
+                    take = maxHeaderSize - m_partial.size();
+                if (take > len)
+                    take = len;
+                m_partial.append(data, take);
+                data += take;
+                len -= take;
+                size_t used = ParseFrames(m_partial.data(), m_partial.size(), onFrame, frames);
+                m_partial.erase(0, used);
+            }
+            size_t used = ParseFrames(data, len, onFrame, frames);
+            m_partial.append(data + used, len - used);
+            WS_TRACE_COUNTER(parser_buffer, m_partial.capacity());
+            return frames;
+        }
+
+        /**
+         * @brief Drop the incomplete frame kept from the last chunk.
+         */
+        void Reset()
+        {
+            m_partial.clear();
+        }
+
+        /**
+         * @brief Free the buffer capacity not needed by the incomplete frame.
+         */
+        void Compact()
+        {
+            if (m_partial.empty())
+                std::string().swap(m_partial);
+            else
+                m_partial.shrink_to_fit();
+            std::string().swap(m_unmasked);
+        }
+
+    private:
+        static const size_t maxHeaderSize = 14;
+
+        struct Header
+        {
+            size_t size;        // header bytes, including the masking key
+            uint64_t payloadlen;
+            bool masked;
+        };
+
+        // Return false if the header is incomplete.
+        static bool DecodeHeader(const char* data, size_t len, Header& header)
+        {
+            const unsigned char* p = (const unsigned char*)data;
+            if (len < 2)
+                return false;
+            header.payloadlen = p[1] & 0x7F;
+            header.size = 2;
+            if (header.payloadlen == 126)
+            {
+                if (len < 4)
+                    return false;
+                header.payloadlen = ((uint64_t)p[2] << 8) | p[3];
+                header.size = 4;
+            }
+            else if (header.payloadlen == 127)
+            {
+                if (len < 10)
+                    return false;
+                header.payloadlen = 0;
+                for (int i = 0; i < 8; ++i)
+                    header.payloadlen = (header.payloadlen << 8) | p[2 + i];
+                header.size = 10;
+            }
+            header.masked = (p[1] & 0x80) != 0;
+            if (header.masked)
+                header.size += 4;
+            return len >= header.size;
+        }
+
+        // Deliver the complete frames of @em data, return the bytes they span.
+        template <class F>
+        size_t ParseFrames(const char* data, size_t len, F& onFrame, size_t& frames)
+        {
+            size_t pos = 0;
+            for (;;)
+            {
+                Header header;
+                if (!DecodeHeader(data + pos, len - pos, header) || len - pos - header.size < header.payloadlen)
+                    break;
+                const char* payload = data + pos + header.size;
+                size_t payloadlen = (size_t)header.payloadlen;
+                FrameType type = (FrameType)(data[pos] & 0x0F);
+                bool fin = (data[pos] & 0x80) != 0;
+                pos += header.size + payloadlen;
+                ++frames;
+                // TODO: parse the reserved bits
+
+                if (Options::binaryOnly && type != Binary && type != Continuation)
+                    continue;
+                if (Options::unmask && header.masked)
+                {
+                    const char* key = payload - 4;
+                    m_unmasked.assign(payload, payloadlen);
+                    for (size_t i = 0; i < payloadlen; ++i)
+                        m_unmasked[i] ^= key[i % 4];
+                    payload = m_unmasked.data();
+                }
+                onFrame(Message(type, payload, payloadlen), fin);
+            }
+            return pos;
+        }
+
+        std::string m_partial;  // incomplete frame at the end of the last chunk
+        std::string m_unmasked;
+    };
+
+}
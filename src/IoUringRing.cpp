@@ -0,0 +1,237 @@
+#include "IoUringRing.h"
+
+#ifdef WEBSOCKET_CLIENT_IO_URING
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+using namespace ws;
+
+#define LOAD_ACQUIRE(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define CPU_RELAX() __asm__ __volatile__("yield")
+#else
+#define CPU_RELAX()
+#endif
+
+// spins before falling back to a system call when waiting in SQPOLL mode
+static const int sqpollSpins = 4096;
+
+IoUringRing::IoUringRing()
+    : m_fd(-1)
+    , m_sqpoll(false)
+    , m_enterCalls(0)
+    , m_sqRing(MAP_FAILED)
+    , m_sqRingSize(0)
+    , m_cqRing(MAP_FAILED)
+    , m_cqRingSize(0)
+    , m_sqes((io_uring_sqe*)MAP_FAILED)
+    , m_sqesSize(0)
+    , m_sqLocalTail(0)
+    , m_bufRing((io_uring_buf_ring*)MAP_FAILED)
+    , m_bufRingSize(0)
+    , m_buffers(NULL)
+    , m_bufferSize(0)
+    , m_bufCount(0)
+    , m_bufGroup(0)
+{
+}
+
+IoUringRing::~IoUringRing()
+{
+    if (m_bufRing != MAP_FAILED)
+    {
+        io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.bgid = m_bufGroup;
+        syscall(__NR_io_uring_register, m_fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+        munmap(m_bufRing, m_bufRingSize);
+    }
+    free(m_buffers);
+    if (m_sqes != MAP_FAILED)
+        munmap(m_sqes, m_sqesSize);
+    if (m_cqRing != MAP_FAILED && m_cqRing != m_sqRing)
+        munmap(m_cqRing, m_cqRingSize);
+    if (m_sqRing != MAP_FAILED)
+        munmap(m_sqRing, m_sqRingSize);
+    if (m_fd >= 0)
+        close(m_fd);
+}
+
+bool IoUringRing::Init(unsigned entries, bool sqpoll)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    if (sqpoll)
+    {
+        params.flags |= IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = 50; // milliseconds before the kernel thread sleeps
+    }
+    m_fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (m_fd < 0)
+        return false;
+    m_sqpoll = sqpoll;
+
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (m_cqRingSize > m_sqRingSize)
+            m_sqRingSize = m_cqRingSize;
+        m_cqRingSize = m_sqRingSize;
+    }
+    m_sqRing = mmap(NULL, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if (m_sqRing == MAP_FAILED)
+        return false;
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        m_cqRing = m_sqRing;
+    }
+    else
+    {
+        m_cqRing = mmap(NULL, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+        if (m_cqRing == MAP_FAILED)
+            return false;
+    }
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = (io_uring_sqe*)mmap(NULL, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if (m_sqes == MAP_FAILED)
+        return false;
+
+    char* sq = (char*)m_sqRing;
+    m_sqHead = (unsigned*)(sq + params.sq_off.head);
+    m_sqTail = (unsigned*)(sq + params.sq_off.tail);
+    m_sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+    m_sqFlags = (unsigned*)(sq + params.sq_off.flags);
+    m_sqArray = (unsigned*)(sq + params.sq_off.array);
+    m_sqLocalTail = *m_sqTail;
+
+    char* cq = (char*)m_cqRing;
+    m_cqHead = (unsigned*)(cq + params.cq_off.head);
+    m_cqTail = (unsigned*)(cq + params.cq_off.tail);
+    m_cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+    m_cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+    return true;
+}
+
+io_uring_sqe* IoUringRing::GetSqe()
+{
+    unsigned head = LOAD_ACQUIRE(m_sqHead);
+    if (m_sqLocalTail - head > *m_sqMask)
+        return NULL;
+    unsigned index = m_sqLocalTail & *m_sqMask;
+    io_uring_sqe* sqe = &m_sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    m_sqArray[index] = index;
+    ++m_sqLocalTail;
+    return sqe;
+}
+
+int IoUringRing::Enter(unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    int ret;
+    do
+    {
+        ++m_enterCalls;
+        ret = (int)syscall(__NR_io_uring_enter, m_fd, toSubmit, minComplete, flags, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+    return ret;
+}
+
+bool IoUringRing::Submit(unsigned waitCount)
+{
+    unsigned toSubmit = m_sqLocalTail - *m_sqTail;
+    STORE_RELEASE(m_sqTail, m_sqLocalTail);
+
+    if (!m_sqpoll)
+    {
+        if (toSubmit == 0 && waitCount == 0)
+            return true;
+        return Enter(toSubmit, waitCount, waitCount ? IORING_ENTER_GETEVENTS : 0) >= 0;
+    }
+
+    // The kernel thread picks the entries up by itself, unless it went to sleep.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (toSubmit && (LOAD_ACQUIRE(m_sqFlags) & IORING_SQ_NEED_WAKEUP))
+    {
+        if (Enter(toSubmit, 0, IORING_ENTER_SQ_WAKEUP) < 0)
+            return false;
+    }
+    for (int i = 0; i < sqpollSpins; ++i)
+    {
+        if (LOAD_ACQUIRE(m_cqTail) - *m_cqHead >= waitCount)
+            return true;
+        CPU_RELAX();
+    }
+    return Enter(0, waitCount, IORING_ENTER_GETEVENTS) >= 0;
+}
+
+io_uring_cqe* IoUringRing::PeekCqe()
+{
+    unsigned head = *m_cqHead;
+    if (head == LOAD_ACQUIRE(m_cqTail))
+        return NULL;
+    return &m_cqes[head & *m_cqMask];
+}
+
+void IoUringRing::SeenCqe()
+{
+    STORE_RELEASE(m_cqHead, *m_cqHead + 1);
+}
+
+bool IoUringRing::SetupBufferRing(unsigned short group, unsigned count, size_t size)
+{
+    m_bufRingSize = count * sizeof(io_uring_buf);
+    void* ring = mmap(NULL, m_bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED)
+        return false;
+    m_buffers = (char*)malloc(count * size);
+    if (!m_buffers)
+    {
+        munmap(ring, m_bufRingSize);
+        return false;
+    }
+
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)ring;
+    reg.ring_entries = count;
+    reg.bgid = group;
+    if (syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        munmap(ring, m_bufRingSize);
+        return false;
+    }
+    m_bufRing = (io_uring_buf_ring*)ring;
+    m_bufferSize = size;
+    m_bufCount = count;
+    m_bufGroup = group;
+    for (unsigned i = 0; i < count; ++i)
+        RecycleBuffer((unsigned short)i);
+    return true;
+}
+
+char* IoUringRing::Buffer(unsigned short bid)
+{
+    return m_buffers + (size_t)bid * m_bufferSize;
+}
+
+void IoUringRing::RecycleBuffer(unsigned short bid)
+{
+    // Not m_bufRing->bufs: the flexible array wrapper of the kernel header is 1 byte off in C++.
+    unsigned short tail = m_bufRing->tail;
+    io_uring_buf* buf = (io_uring_buf*)m_bufRing + (tail & (m_bufCount - 1));
+    buf->addr = (uint64_t)(uintptr_t)Buffer(bid);
+    buf->len = (uint32_t)m_bufferSize;
+    buf->bid = bid;
+    STORE_RELEASE(&m_bufRing->tail, (unsigned short)(tail + 1));
+}
+
+#endif // WEBSOCKET_CLIENT_IO_URING
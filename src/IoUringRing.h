@@ -0,0 +1,124 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// io_uring needs Linux 6.0+ headers for multishot receive into provided buffer rings.
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#if defined(IORING_RECV_MULTISHOT) && defined(IORING_SETUP_SQPOLL)
+#define WEBSOCKET_CLIENT_IO_URING 1
+#endif
+#endif
+#endif
+
+#ifdef WEBSOCKET_CLIENT_IO_URING
+
+namespace ws {
+
+    /**
+     * @brief A minimal io_uring instance, talking to the kernel through raw system calls.
+     *
+     * Only what the websocket transport needs is wrapped: submission/completion queues, waiting for
+     * completions, and a ring of provided buffers for multishot receive.
+     * @note Not thread-safe, each ring is driven by one thread at a time.
+     */
+    class IoUringRing
+    {
+    public:
+        IoUringRing();
+        ~IoUringRing();
+
+        /**
+         * @brief Create the ring.
+         * @param entries submission queue size
+         * @param sqpoll let a kernel thread poll the submission queue, so submitting needs no system call
+         * @return false if io_uring is not available
+         */
+        bool Init(unsigned entries, bool sqpoll);
+
+        /**
+         * @brief Get a free submission queue entry, zero-filled.
+         * @return NULL if the submission queue is full
+         */
+        io_uring_sqe* GetSqe();
+
+        /**
+         * @brief Submit the queued entries and wait until at least @em waitCount completions are available.
+         * @return false on failure
+         *
+         * In SQPOLL mode no system call is made unless the kernel thread needs a wakeup, and completions are
+         * waited for by spinning.
+         */
+        bool Submit(unsigned waitCount);
+
+        /**
+         * @brief Get the next completion queue entry without waiting.
+         * @return NULL if none is available
+         */
+        io_uring_cqe* PeekCqe();
+
+        /**
+         * @brief Mark the entry returned by @em PeekCqe() as consumed.
+         */
+        void SeenCqe();
+
+        /**
+         * @brief Register a ring of @em count buffers of @em size bytes for buffer group @em group.
+         * @param count number of buffers, must be a power of 2
+         * @return false if provided buffer rings are not supported
+         */
+        bool SetupBufferRing(unsigned short group, unsigned count, size_t size);
+
+        /**
+         * @brief Get the buffer which id is @em bid, as reported in a completion flags.
+         */
+        char* Buffer(unsigned short bid);
+
+        /**
+         * @brief Give buffer @em bid back to the kernel.
+         */
+        void RecycleBuffer(unsigned short bid);
+
+        /**
+         * @brief Number of io_uring_enter system calls made so far.
+         */
+        uint64_t EnterCalls() const { return m_enterCalls; }
+
+    private:
+        int Enter(unsigned toSubmit, unsigned minComplete, unsigned flags);
+
+        int m_fd;
+        bool m_sqpoll;
+        uint64_t m_enterCalls;
+
+        void* m_sqRing;
+        size_t m_sqRingSize;
+        void* m_cqRing;
+        size_t m_cqRingSize;
+        io_uring_sqe* m_sqes;
+        size_t m_sqesSize;
+
+        unsigned* m_sqHead;
+        unsigned* m_sqTail;
+        unsigned* m_sqMask;
+        unsigned* m_sqFlags;
+        unsigned* m_sqArray;
+        unsigned m_sqLocalTail;     // entries handed out by GetSqe(), published on Submit()
+
+        unsigned* m_cqHead;
+        unsigned* m_cqTail;
+        unsigned* m_cqMask;
+        io_uring_cqe* m_cqes;
+
+        io_uring_buf_ring* m_bufRing;
+        size_t m_bufRingSize;
+        char* m_buffers;
+        size_t m_bufferSize;
+        unsigned m_bufCount;
+        unsigned short m_bufGroup;
+    };
+
+}
+
+#endif // WEBSOCKET_CLIENT_IO_URING
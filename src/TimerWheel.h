@@ -0,0 +1,208 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+namespace ws {
+
+    /**
+     * @brief A timer of @em TimerWheel, embedded in the object it times.
+     */
+    struct TimerNode
+    {
+        TimerNode() : prev(NULL), next(NULL), expires(0), fire(NULL), opaque(NULL) {}
+
+        TimerNode* prev;
+        TimerNode* next;                // NULL while not scheduled
+        uint64_t expires;               // tick
+        void (*fire)(TimerNode* node);  // called by @em TimerWheel::Advance() for the default callback
+        void* opaque;                   // private pointer for @em fire
+    };
+
+    /**
+     * @brief Hierarchical timing wheel: O(1) schedule and cancel, expiry in amortized O(1) per timer.
+     *
+     * Four levels of 256 slots cover 2^32 ticks, each level 256 times the span of the one below. A timer sits in
+     * the lowest level whose span reaches its expiry, and moves down a level each time the wheel below wraps
+     * around, so it is touched at most four times. Timers are intrusive lists of @em TimerNode, the wheel never
+     * allocates. Not thread-safe, the owner serializes the calls.
+     */
+    class TimerWheel
+    {
+    public:
+        explicit TimerWheel(uint64_t now = 0) : m_now(now), m_count(0)
+        {
+            for (int level = 0; level < levels; ++level)
+            {
+                for (int slot = 0; slot < slots; ++slot)
+                    m_slots[level][slot].prev = m_slots[level][slot].next = &m_slots[level][slot];
+            }
+        }
+
+        /**
+         * @brief Arm @em node to expire at tick @em expires, moving it if it was already armed.
+         *
+         * A tick not after the current one expires at the next @em Advance().
+         */
+        void Schedule(TimerNode* node, uint64_t expires)
+        {
+            if (node->next)
+                Unlink(node);
+            else
+                ++m_count;
+            node->expires = expires;
+            Place(node);
+        }
+
+        /**
+         * @brief Disarm @em node, if it is armed.
+         */
+        void Cancel(TimerNode* node)
+        {
+            if (!node->next)
+                return;
+            Unlink(node);
+            --m_count;
+        }
+
+        static bool Scheduled(const TimerNode* node)
+        {
+            return node->next != NULL;
+        }
+
+        /**
+         * @brief Move the wheel to tick @em now and expire the timers due.
+         * @param fire called as @em fire(TimerNode* node) for every expired timer, which is disarmed before. It
+         * may schedule and cancel timers, those due by @em now expire in this call too.
+         * @return number of expired timers
+         */
+        template <class F>
+        size_t Advance(uint64_t now, F&& fire)
+        {
+            size_t fired = 0;
+            TimerNode due;
+            while (m_now < now || Pending(m_now))
+            {
+                if (!Pending(m_now))
+                {
+                    ++m_now;
+                    if ((m_now & (slots - 1)) == 0)
+                        Cascade();
+                }
+                // Detach the slot first, callbacks may cancel the timers in it.
+                TimerNode* head = &m_slots[0][m_now & (slots - 1)];
+                if (head->next == head)
+                    continue;
+                due.prev = head->prev;
+                due.next = head->next;
+                due.prev->next = due.next->prev = &due;
+                head->prev = head->next = head;
+                while (due.next != &due)
+                {
+                    TimerNode* node = due.next;
+                    Unlink(node);
+                    --m_count;
+                    ++fired;
+                    fire(node);
+                }
+            }
+            return fired;
+        }
+
+        size_t Advance(uint64_t now)
+        {
+            return Advance(now, [](TimerNode* node) { node->fire(node); });
+        }
+
+        /**
+         * @brief Tick by which @em Advance() has to be called again, @em UINT64_MAX if no timer is armed.
+         *
+         * The next expiry when it is in the lowest level, otherwise the next time the lowest level wraps around
+         * and timers move down.
+         */
+        uint64_t NextTick() const
+        {
+            if (m_count == 0)
+                return UINT64_MAX;
+            uint64_t tick = m_now;
+            do
+            {
+                if (Pending(tick))
+                    return tick;
+                ++tick;
+            } while (tick & (slots - 1));
+            return tick;
+        }
+
+        size_t Size() const
+        {
+            return m_count;
+        }
+
+        uint64_t Now() const
+        {
+            return m_now;
+        }
+
+    private:
+        static const int levelBits = 8;
+        static const int slots = 1 << levelBits;
+        static const int levels = 4;
+
+        bool Pending(uint64_t tick) const
+        {
+            const TimerNode* head = &m_slots[0][tick & (slots - 1)];
+            return head->next != head;
+        }
+
+        void Place(TimerNode* node)
+        {
+            uint64_t expires = node->expires > m_now ? node->expires : m_now;
+            int level = 0;
+            while (level < levels - 1 && (expires >> (levelBits * (level + 1))) != (m_now >> (levelBits * (level + 1))))
+                ++level;
+            size_t slot;
+            if (level == levels - 1 && (expires >> (levelBits * levels)) != (m_now >> (levelBits * levels)))
+                slot = 0;   // beyond the wheel, placed again when the top level wraps around
+            else
+                slot = (expires >> (levelBits * level)) & (slots - 1);
+            TimerNode* head = &m_slots[level][slot];
+            node->prev = head->prev;
+            node->next = head;
+            head->prev->next = node;
+            head->prev = node;
+        }
+
+        static void Unlink(TimerNode* node)
+        {
+            node->prev->next = node->next;
+            node->next->prev = node->prev;
+            node->prev = node->next = NULL;
+        }
+
+        // The lowest level wrapped around: move the timers of the slots now current in the upper levels down,
+        // from the top so that timers can fall through several levels.
+        void Cascade()
+        {
+            int top = 1;
+            while (top < levels - 1 && ((m_now >> (levelBits * top)) & (slots - 1)) == 0)
+                ++top;
+            for (int level = top; level >= 1; --level)
+            {
+                TimerNode* head = &m_slots[level][(m_now >> (levelBits * level)) & (slots - 1)];
+                TimerNode* node = head->next;
+                head->prev = head->next = head;
+                while (node != head)
+                {
+                    TimerNode* next = node->next;
+                    Place(node);
+                    node = next;
+                }
+            }
+        }
+
+        TimerNode m_slots[levels][slots];   // list heads
+        uint64_t m_now;                     // current tick
+        size_t m_count;
+    };
+
+}
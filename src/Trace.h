@@ -0,0 +1,210 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Trace points of the hot paths, compiled in when WEBSOCKET_CLIENT_TRACE is defined and empty otherwise.
+ *
+ * Each thread records its events into a ring of its own without locking, @em ws::trace::DumpChromeTrace()
+ * writes the rings as a Chrome trace (chrome://tracing, ui.perfetto.dev). Where <sys/sdt.h> is available every
+ * trace point is also a USDT probe of provider "websocket_client", for perf and bpftrace.
+ *
+ * WS_TRACE_SCOPE(name, value)      the rest of the enclosing block, as a duration
+ * WS_TRACE_INSTANT(name, value)    a point in time
+ * WS_TRACE_COUNTER(name, value)    a new value of a counter
+ *
+ * @em name is an identifier, @em value an unsigned integer shown as the argument of the event.
+ */
+
+#ifdef WEBSOCKET_CLIENT_TRACE
+
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define WS_TRACE_USDT(name, value) DTRACE_PROBE1(websocket_client, name, value)
+#endif
+#endif
+#ifndef WS_TRACE_USDT
+#define WS_TRACE_USDT(name, value) ((void)0)
+#endif
+
+// events kept per thread, the oldest are overwritten
+#ifndef WEBSOCKET_CLIENT_TRACE_EVENTS
+#define WEBSOCKET_CLIENT_TRACE_EVENTS 8192
+#endif
+
+#define WS_TRACE_SCOPE(name, value) \
+    WS_TRACE_USDT(name, value); \
+    ws::trace::Scope wsTraceScope_##name(#name, value)
+#define WS_TRACE_INSTANT(name, value) \
+    do { WS_TRACE_USDT(name, value); ws::trace::Record(#name, 'i', ws::trace::Now(), 0, value); } while (0)
+#define WS_TRACE_COUNTER(name, value) \
+    do { WS_TRACE_USDT(name, value); ws::trace::Record(#name, 'C', ws::trace::Now(), 0, value); } while (0)
+
+namespace ws {
+namespace trace {
+
+    struct Event
+    {
+        const char* name;
+        uint64_t time;      // nanoseconds, steady clock
+        uint64_t duration;  // nanoseconds, scopes only
+        uint64_t value;
+        char phase;         // Chrome trace phase: 'X' scope, 'i' instant, 'C' counter
+    };
+
+    struct Ring
+    {
+        Event events[WEBSOCKET_CLIENT_TRACE_EVENTS];
+        std::atomic<uint64_t> count;    // events recorded so far
+        int tid;
+        bool retired;                   // the thread exited, freed by the next dump
+    };
+
+    struct Registry
+    {
+        std::mutex mutex;
+        std::vector<Ring*> rings;
+        int nextTid;
+
+        Registry() : nextTid(0) {}
+
+        static Registry& Instance()
+        {
+            static Registry* registry = new Registry();  // never destroyed, threads may exit after main()
+            return *registry;
+        }
+    };
+
+    // Registers the ring of a thread, and retires it when the thread exits.
+    struct RingHolder
+    {
+        Ring* ring;
+
+        RingHolder() : ring(new Ring())
+        {
+            Registry& registry = Registry::Instance();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            ring->count = 0;
+            ring->tid = ++registry.nextTid;
+            ring->retired = false;
+            registry.rings.push_back(ring);
+        }
+        ~RingHolder()
+        {
+            std::lock_guard<std::mutex> lock(Registry::Instance().mutex);
+            ring->retired = true;
+        }
+    };
+
+    inline uint64_t Now()
+    {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    inline void Record(const char* name, char phase, uint64_t time, uint64_t duration, uint64_t value)
+    {
+        static thread_local RingHolder holder;
+        Ring* ring = holder.ring;
+        uint64_t count = ring->count.load(std::memory_order_relaxed);
+        Event& event = ring->events[count % WEBSOCKET_CLIENT_TRACE_EVENTS];
+        event.name = name;
+        event.time = time;
+        event.duration = duration;
+        event.value = value;
+        event.phase = phase;
+        ring->count.store(count + 1, std::memory_order_release);
+    }
+
+    class Scope
+    {
+    public:
+        Scope(const char* name, uint64_t value) : m_name(name), m_value(value), m_begin(Now()) {}
+        ~Scope()
+        {
+            uint64_t end = Now();
+            Record(m_name, 'X', m_begin, end - m_begin, m_value);
+        }
+
+    private:
+        const char* m_name;
+        uint64_t m_value;
+        uint64_t m_begin;
+    };
+
+    /**
+     * @brief Write the events recorded by all threads as Chrome trace JSON.
+     * @param path file to create
+     * @return false if the file cannot be created, or tracing is not compiled in
+     * @note Events recorded while dumping may show up torn, dump while the clients are quiet.
+     */
+    inline bool DumpChromeTrace(const char* path)
+    {
+        FILE* file = fopen(path, "w");
+        if (!file)
+            return false;
+        Registry& registry = Registry::Instance();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+        bool first = true;
+        for (size_t i = 0; i < registry.rings.size(); ++i)
+        {
+            Ring* ring = registry.rings[i];
+            uint64_t count = ring->count.load(std::memory_order_acquire);
+            uint64_t begin = count > WEBSOCKET_CLIENT_TRACE_EVENTS ? count - WEBSOCKET_CLIENT_TRACE_EVENTS : 0;
+            for (uint64_t j = begin; j < count; ++j)
+            {
+                const Event& event = ring->events[j % WEBSOCKET_CLIENT_TRACE_EVENTS];
+                fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":1,\"tid\":%d,\"ts\":%.3f", first ? "" : ",\n",
+                        event.name, event.phase, ring->tid, event.time / 1000.0);
+                if (event.phase == 'X')
+                    fprintf(file, ",\"dur\":%.3f", event.duration / 1000.0);
+                else if (event.phase == 'i')
+                    fprintf(file, ",\"s\":\"t\"");
+                fprintf(file, ",\"args\":{\"value\":%llu}}", (unsigned long long)event.value);
+                first = false;
+            }
+        }
+        fprintf(file, "\n]}\n");
+
+        // The rings of exited threads are not needed anymore.
+        size_t kept = 0;
+        for (size_t i = 0; i < registry.rings.size(); ++i)
+        {
+            if (registry.rings[i]->retired)
+                delete registry.rings[i];
+            else
+                registry.rings[kept++] = registry.rings[i];
+        }
+        registry.rings.resize(kept);
+        return fclose(file) == 0;
+    }
+
+}
+}
+
+#else
+
+#define WS_TRACE_SCOPE(name, value) ((void)0)
+#define WS_TRACE_INSTANT(name, value) ((void)0)
+#define WS_TRACE_COUNTER(name, value) ((void)0)
+
+namespace ws {
+namespace trace {
+
+    inline bool DumpChromeTrace(const char* /*path*/)
+    {
+        return false;
+    }
+
+}
+}
+
+#endif // WEBSOCKET_CLIENT_TRACE
@@ -35,11 +35,38 @@ Frame:
 +---------------------------------------------------------------+
 */
 #include "WebSocketClientImplCurl.h"
+#include "IoUringRing.h"
+#include <ctype.h>
 #include <string.h>
+#include <errno.h>
+#include <algorithm>
 #include <thread>
 #include <ctime>
+#include <random>
+#include <vector>
+#ifdef WEBSOCKET_CLIENT_OPENSSL
+#include <openssl/ssl.h>
+#endif
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#endif
 using namespace ws;
 
+// curl 7.86 and later declare a WebSocket API, which works if libcurl was built with it.
+#ifdef CURLWS_BINARY
+#define WEBSOCKET_CLIENT_CURL_WS 1
+#endif
+
 struct WsHeaderLittleEndian
 {
     uint8_t opcode : 4;
@@ -107,15 +134,149 @@ union mask
     char chararr[4];
     int32_t integer;
 };
-static void WsMask(char* data, uint64_t len, const char mask_key[4])
+// copy @em len bytes from @em src to @em dst and mask them on the way, @em dst may be @em src
+static void WsMaskCopy(char* dst, const char* src, uint64_t len, const char mask_key[4])
 {
-    for (int i = 0; i < len; ++i)
+    // 8 bytes at a time with the key repeated twice, the compiler vectorizes the loop.
+    uint32_t key32;
+    memcpy(&key32, mask_key, sizeof(key32));
+    uint64_t key64 = ((uint64_t)key32 << 32) | key32;
+    uint64_t i = 0;
+    for (; i + 8 <= len; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, src + i, sizeof(word));
+        word ^= key64;
+        memcpy(dst + i, &word, sizeof(word));
+    }
+    for (; i < len; ++i)
     {
         int j = i % 4;
-        data[i] = data[i] ^ mask_key[j];
+        dst[i] = src[i] ^ mask_key[j];
+    }
+}
+
+static void WsMask(char* data, uint64_t len, const char mask_key[4])
+{
+    WsMaskCopy(data, data, len, mask_key);
+}
+
+static int32_t NewMaskKey()
+{
+    static thread_local std::minstd_rand engine(std::random_device{}());
+    return (int32_t)engine();
+}
+
+// 2 bytes header, 8 bytes extended length and 4 bytes masking key at most
+#define MAX_WS_HEADER_SIZE 14
+
+// payload size of each fragment of a streamed message
+static const size_t streamChunkSize = 64 * 1024;
+
+// leading bytes of a capture file written by SetCaptureFile()
+#define CAPTURE_MAGIC "WSCAP001"
+
+// leading bytes of a spool file written by SetSpoolFile()
+#define SPOOL_MAGIC "WSSPOOL1"
+
+// The first page of a spool file, the encoded frames follow it. Offsets count every byte ever spooled.
+struct WebSocketClientImplCurl::SpoolHeader
+{
+    char magic[8];
+    uint64_t capacity;  // bytes of frames the file holds
+    uint64_t base;      // offset of the first frame byte after the header
+    uint64_t write;     // offset of the end of the spooled frames
+    uint64_t ack;       // offset up to which the frames were delivered, sending resumes here
+};
+static const size_t spoolHeaderSize = 4096;
+
+// size of the receive buffer when the client reads the socket itself
+static const size_t recvBufferSize = 64 * 1024;
+
+#ifdef __linux__
+// room for the SCM_TIMESTAMPING control message received with a chunk
+static const size_t timestampControlSize = CMSG_SPACE(sizeof(scm_timestamping));
+
+// Get the receive timestamp out of the control messages of @em msg, 0 if there is none.
+static uint64_t ReadTimestamp(msghdr* msg)
+{
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET ||
+            (cmsg->cmsg_type != SCM_TIMESTAMPING && cmsg->cmsg_type != SCM_TIMESTAMPNS))
+            continue;
+        // SCM_TIMESTAMPING carries the software timestamp first, SCM_TIMESTAMPNS only that one.
+        timespec ts;
+        memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
     }
+    return 0;
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define CPU_RELAX() __asm__ __volatile__("yield")
+#else
+#define CPU_RELAX()
+#endif
+
+#ifdef _WIN32
+#define poll WSAPoll
+#define close_socket closesocket
+#else
+#define close_socket close
+#endif
+
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+static bool SocketWouldBlock()
+{
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+// TLS sessions shared by all clients, guarded by one lock per kind of shared data.
+static std::mutex shareLocks[CURL_LOCK_DATA_LAST];
+static CURLSH* sharedSessions = NULL;
+static std::once_flag sharedSessionsOnce;
+
+static void ShareLock(CURL* handle, curl_lock_data data, curl_lock_access access, void* userptr)
+{
+    shareLocks[data].lock();
+}
+
+static void ShareUnlock(CURL* handle, curl_lock_data data, void* userptr)
+{
+    shareLocks[data].unlock();
 }
 
+static void InitSharedSessions()
+{
+    sharedSessions = curl_share_init();
+    if (!sharedSessions)
+        return;
+    curl_share_setopt(sharedSessions, CURLSHOPT_LOCKFUNC, ShareLock);
+    curl_share_setopt(sharedSessions, CURLSHOPT_UNLOCKFUNC, ShareUnlock);
+    curl_share_setopt(sharedSessions, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+}
+
+#ifdef WEBSOCKET_CLIENT_OPENSSL
+static CURLcode SslCtxCallback(CURL* curl, void* sslctx, void* userptr)
+{
+    SSL_CTX_set_options((SSL_CTX*)sslctx, SSL_OP_ENABLE_KTLS);
+    return CURLE_OK;
+}
+#endif
+
 //! [default HTTP header]
 static const char *defaultHeaders[] = {
     "HTTP/1.1 101 WebSocket Protocol Handshake",
@@ -126,6 +287,159 @@ static const char *defaultHeaders[] = {
 };
 //! [default HTTP header]
 
+// The default header list is built once and shared by the clients using it.
+static curl_slist* defaultHeaderList = NULL;
+static std::once_flag defaultHeaderListOnce;
+
+static void InitDefaultHeaderList()
+{
+    for (size_t i = 0; i < sizeof(defaultHeaders) / sizeof(char*); ++i)
+        defaultHeaderList = curl_slist_append(defaultHeaderList, defaultHeaders[i]);
+}
+
+// Receive buffers released by idle connections, a few are kept for the next wakeups.
+static std::mutex recvPoolMutex;
+static std::vector<char*> recvPool;
+static const size_t recvPoolMax = 64;
+
+static char* AcquireRecvBuffer()
+{
+    {
+        std::lock_guard<std::mutex> lock(recvPoolMutex);
+        if (!recvPool.empty())
+        {
+            char* buff = recvPool.back();
+            recvPool.pop_back();
+            return buff;
+        }
+    }
+#ifdef _WIN32
+    return (char*)malloc(recvBufferSize);
+#else
+    // mapped rather than from the heap, so a released buffer really leaves the process
+    void* buff = mmap(NULL, recvBufferSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return buff == MAP_FAILED ? NULL : (char*)buff;
+#endif
+}
+
+static void ReleaseRecvBuffer(char* buff)
+{
+    {
+        std::lock_guard<std::mutex> lock(recvPoolMutex);
+        if (recvPool.size() < recvPoolMax)
+        {
+            recvPool.push_back(buff);
+            return;
+        }
+    }
+#ifdef _WIN32
+    free(buff);
+#else
+    munmap(buff, recvBufferSize);
+#endif
+}
+
+// One thread drives the timeouts of all clients with a timer wheel, in milliseconds of the steady clock. Timers
+// fire with the lock held, work which sends is deferred until the lock is released.
+class TimerService
+{
+public:
+    static TimerService& Instance()
+    {
+        static TimerService* service = new TimerService;  // never destroyed, its thread runs until exit
+        return *service;
+    }
+
+    static uint64_t Now()
+    {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Arm @em node to fire in @em milliseconds, the caller holds @em mutex.
+    void Schedule(TimerNode* node, unsigned milliseconds)
+    {
+        uint64_t expires = Now() + milliseconds;
+        m_wheel.Schedule(node, expires);
+        if (expires < m_wakeAt)
+            m_cond.notify_one();
+    }
+
+    // The caller holds @em mutex.
+    void Cancel(TimerNode* node)
+    {
+        m_wheel.Cancel(node);
+    }
+
+    // Call @em run(opaque) once the expired timers have fired, without @em mutex. The caller holds @em mutex.
+    void Defer(void (*run)(void*), void* opaque)
+    {
+        for (size_t i = 0; i < m_deferred.size(); ++i)
+        {
+            if (m_deferred[i].second == opaque)
+                return;
+        }
+        m_deferred.push_back(Deferred(run, opaque));
+    }
+
+    // Drop the deferred work of @em opaque and wait until a call of it returned. The caller holds @em lock.
+    void Forget(void* opaque, std::unique_lock<std::mutex>& lock)
+    {
+        for (size_t i = 0; i < m_deferred.size(); ++i)
+        {
+            if (m_deferred[i].second == opaque)
+            {
+                m_deferred.erase(m_deferred.begin() + i);
+                break;
+            }
+        }
+        m_idle.wait(lock, [this, opaque] { return m_running != opaque; });
+    }
+
+    std::mutex mutex;   // guards the wheel, held while timers fire
+
+private:
+    typedef std::pair<void (*)(void*), void*> Deferred;
+
+    TimerService() : m_wheel(Now()), m_wakeAt(UINT64_MAX), m_running(NULL)
+    {
+        std::thread(&TimerService::Run, this).detach();
+    }
+
+    void Run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;)
+        {
+            m_wheel.Advance(Now());
+            while (!m_deferred.empty())
+            {
+                Deferred work = m_deferred.front();
+                m_deferred.erase(m_deferred.begin());
+                m_running = work.second;
+                lock.unlock();
+                work.first(work.second);
+                lock.lock();
+                m_running = NULL;
+                m_idle.notify_all();
+            }
+            m_wakeAt = m_wheel.NextTick();
+            uint64_t now = Now();
+            if (m_wakeAt == UINT64_MAX)
+                m_cond.wait(lock);
+            else if (m_wakeAt > now)
+                m_cond.wait_for(lock, std::chrono::milliseconds(m_wakeAt - now));
+        }
+    }
+
+    TimerWheel m_wheel;
+    std::condition_variable m_cond;
+    uint64_t m_wakeAt;  // tick the thread sleeps until
+    std::vector<Deferred> m_deferred;
+    void* m_running;    // opaque of the deferred work being run
+    std::condition_variable m_idle;
+};
+
 WebSocketClientImplCurl::WebSocketClientImplCurl()
     : WebSocketClientImplCurl(defaultHeaders, sizeof(defaultHeaders) / sizeof(char *))
 {
@@ -137,10 +451,73 @@ WebSocketClientImplCurl::WebSocketClientImplCurl(const char ** customHeader, int
     , m_header_list_ptr(NULL)
     , m_sockfd(0)
     , m_state(WebSocketClientImplCurl::Disconnected)
+    , m_transport(TransportCurl)
+    , m_detached(false)
+    , m_tls(false)
+    , m_abort(false)
+    , m_ktlsSend(false)
+    , m_ktlsRecv(false)
+    , m_idleTimeout(0)
+    , m_timestamps(false)
+    , m_kernelTime(0)
+    , m_busyPoll(false)
+    , m_busyPollCpu(-1)
+    , m_socketBusyPoll(0)
+    , m_staggerMs(0)
+    , m_raceWinner(NULL)
+    , m_inboundFrames(0)
+    , m_inboundPayload(0)
+    , m_maxInboundBytes(0)
+    , m_maxInboundFrames(0)
+    , m_heldBytes(0)
+    , m_heldFrames(0)
+    , m_inboundPaused(false)
+    , m_inboundClosing(false)
+    , m_capture(NULL)
     , sendbuff(NULL)
     , sendbufflen(0)
     , sendoffset(0)
+    , m_sendFrames(0)
+    , m_stream(NULL)
+    , m_maxFrameSize(0)
+    , m_sendRing(NULL)
+    , m_controlLeft(0)
+    , m_conflatedBytes(0)
+    , m_coalesceDelay(0)
+    , m_coalesceBytes(0)
+    , m_batch(NULL)
+    , m_batchLen(0)
+    , m_batchCap(0)
+    , m_batchFrames(0)
+    , m_lastFlush(0)
+    , m_spool(NULL)
+    , m_spoolData(NULL)
+    , m_spoolMapped(0)
+    , m_spoolSent(0)
+    , m_spoolManualAck(false)
+    , m_sendFromSpool(false)
+    , m_wsHeaders(NULL)
+    , m_wsType(Binary)
+    , m_wsSending(false)
+    , m_wsContinued(false)
+    , m_handshakeTimeout(0)
+    , m_receiveTimeout(0)
+    , m_pingInterval(0)
+    , m_closeTimeout(0)
+    , m_lastInbound(0)
+    , m_timerSocket(CURL_SOCKET_BAD)
+    , m_timerMulti(NULL)
+    , m_timedOut(false)
+    , m_pingDue(false)
+    , m_connThreads(0)
 {
+    TimerNode* timers[] = { &m_handshakeTimer, &m_receiveTimer, &m_pingTimer, &m_closeTimer, &m_flushTimer };
+    for (size_t i = 0; i < sizeof(timers) / sizeof(timers[0]); ++i)
+    {
+        timers[i]->fire = OnTimer;
+        timers[i]->opaque = this;
+    }
+
     // Init curl
     m_curl = curl_easy_init();
     if (!m_curl)
@@ -152,12 +529,20 @@ WebSocketClientImplCurl::WebSocketClientImplCurl(const char ** customHeader, int
         customHeader = defaultHeaders;
         nlines = sizeof(defaultHeaders) / sizeof(char*);
     }
-    m_header_list_ptr = curl_slist_append(NULL, customHeader[0]);
-    for (int i = 1; i < nlines; ++i)
+    if (customHeader == defaultHeaders)
+    {
+        std::call_once(defaultHeaderListOnce, InitDefaultHeaderList);
+        curl_easy_setopt(m_curl, CURLOPT_HTTPHEADER, defaultHeaderList);
+    }
+    else
     {
-        m_header_list_ptr = curl_slist_append(m_header_list_ptr, customHeader[i]);
+        m_header_list_ptr = curl_slist_append(NULL, customHeader[0]);
+        for (int i = 1; i < nlines; ++i)
+        {
+            m_header_list_ptr = curl_slist_append(m_header_list_ptr, customHeader[i]);
+        }
+        curl_easy_setopt(m_curl, CURLOPT_HTTPHEADER, m_header_list_ptr);
     }
-    curl_easy_setopt(m_curl, CURLOPT_HTTPHEADER, m_header_list_ptr);
 
     // Set HTTP callbacks
     curl_easy_setopt(m_curl, CURLOPT_OPENSOCKETFUNCTION, OpenSocketCallback);
@@ -166,31 +551,209 @@ WebSocketClientImplCurl::WebSocketClientImplCurl(const char ** customHeader, int
     curl_easy_setopt(m_curl, CURLOPT_HEADERDATA, this);
     curl_easy_setopt(m_curl, CURLOPT_WRITEFUNCTION, OnMessageReceived);
     curl_easy_setopt(m_curl, CURLOPT_WRITEDATA, this);
+    curl_easy_setopt(m_curl, CURLOPT_CLOSESOCKETFUNCTION, CloseSocketCallback);
+    curl_easy_setopt(m_curl, CURLOPT_CLOSESOCKETDATA, this);
+    curl_easy_setopt(m_curl, CURLOPT_XFERINFOFUNCTION, ProgressCallback);
+    curl_easy_setopt(m_curl, CURLOPT_XFERINFODATA, this);
+    curl_easy_setopt(m_curl, CURLOPT_NOPROGRESS, 0L);
+    curl_easy_setopt(m_curl, CURLOPT_FORBID_REUSE, 1L);  // the connection is closed when the transfer ends
 
-
+    SetTlsSessionSharing(true);
 }
 
 WebSocketClientImplCurl::~WebSocketClientImplCurl()
 {
+    {
+        // The connection thread uses this object until it returns, give the connection up and wait for it.
+        std::lock_guard<std::mutex> lock(TimerService::Instance().mutex);
+        Abort();
+    }
+    while (m_connThreads)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    StopTimers();
+    ClearSendBuff();
+    free(m_batch);
+    CloseSpool();
+    SetCaptureFile(NULL);
     curl_slist_free_all(m_header_list_ptr);
+    curl_slist_free_all(m_wsHeaders);
     curl_easy_cleanup(m_curl);
 }
 
+// Point @em handle at @em url. A ws+unix:// or wss+unix:// url names a unix domain socket and the request path
+// after a colon, e.g. ws+unix:///run/app.sock:/ws, it is requested over that socket as http(s)://localhost/ws.
+// @em websocket asks for the ws:// and wss:// schemes of curl, http(s):// urls are converted.
+static void SetUrl(CURL* handle, const char* url, bool websocket = false)
+{
+    const char* rest = NULL;
+    const char* scheme = NULL;
+    if (strncmp(url, "ws+unix://", 10) == 0)
+    {
+        rest = url + 10;
+        scheme = "http://localhost";
+    }
+    else if (strncmp(url, "wss+unix://", 11) == 0)
+    {
+        rest = url + 11;
+        scheme = "https://localhost";
+    }
+    if (!rest)
+    {
+        std::string converted;
+        if (websocket && strncmp(url, "http", 4) == 0)
+        {
+            converted = std::string("ws") + (url + 4);
+            url = converted.c_str();
+        }
+        curl_easy_setopt(handle, CURLOPT_UNIX_SOCKET_PATH, (char*)NULL);
+        curl_easy_setopt(handle, CURLOPT_URL, url);
+        return;
+    }
+    const char* colon = strchr(rest, ':');
+    std::string path = colon ? std::string(rest, colon) : std::string(rest);
+    std::string http = std::string(scheme) + (colon && colon[1] ? colon + 1 : "/");
+    if (websocket)
+        http.replace(0, 4, "ws");
+    curl_easy_setopt(handle, CURLOPT_UNIX_SOCKET_PATH, path.c_str());
+    curl_easy_setopt(handle, CURLOPT_URL, http.c_str());
+}
+
+// Whether a custom header line is one of those curl generates for the handshake in its WebSocket mode.
+static bool IsHandshakeHeader(const char* line)
+{
+    static const char* generated[] = { "Upgrade:", "Connection:", "Sec-WebSocket-Key:", "Sec-WebSocket-Version:" };
+    for (size_t i = 0; i < sizeof(generated) / sizeof(generated[0]); ++i)
+    {
+        const char* name = generated[i];
+        const char* p = line;
+        while (*name && tolower((unsigned char)*p) == tolower((unsigned char)*name))
+        {
+            ++p;
+            ++name;
+        }
+        if (!*name)
+            return true;
+    }
+    return false;
+}
+
 void WebSocketClientImplCurl::Connect(const char * url)
 {
-    curl_easy_setopt(m_curl, CURLOPT_URL, url);
+    bool websocket = m_transport == TransportCurlWebSocket;
+    SetUrl(m_curl, url, websocket);
+#ifdef WEBSOCKET_CLIENT_CURL_WS
+    // curl stops after the handshake, its WebSocket API takes over the connection.
+    curl_slist* headers = m_header_list_ptr ? m_header_list_ptr : defaultHeaderList;
+    if (websocket)
+    {
+        if (!m_wsHeaders)
+        {
+            for (curl_slist* line = headers; line; line = line->next)
+            {
+                if (!IsHandshakeHeader(line->data))
+                    m_wsHeaders = curl_slist_append(m_wsHeaders, line->data);
+            }
+        }
+        curl_easy_setopt(m_curl, CURLOPT_CONNECT_ONLY, 2L);
+        curl_easy_setopt(m_curl, CURLOPT_HTTPHEADER, m_wsHeaders);
+        // The connection outlives the handshake transfer, curl would close it right after.
+        curl_easy_setopt(m_curl, CURLOPT_FORBID_REUSE, 0L);
+    }
+    else if (m_wsHeaders)
+    {
+        // Back from TransportCurlWebSocket.
+        curl_easy_setopt(m_curl, CURLOPT_CONNECT_ONLY, 0L);
+        curl_easy_setopt(m_curl, CURLOPT_HTTPHEADER, headers);
+        curl_easy_setopt(m_curl, CURLOPT_FORBID_REUSE, 1L);
+    }
+#endif
+    m_endpoints.clear();
+    ResetSpool();
+    m_abort = false;
+    m_tls = false;      // known once the handshake answered, see CheckTls()
+    m_ktlsSend = false;
+    m_ktlsRecv = false;
+    m_inboundClosing = false;
+    m_heldBytes = 0;
+    m_heldFrames = 0;
+    ResetInbound();
+    ++m_connThreads;
+    std::thread th_conn(ConnProc, this);
+    th_conn.detach();
+}
+
+void WebSocketClientImplCurl::Connect(const char* const* urls, int count, unsigned staggerMs)
+{
+    if (count <= 0)
+        return;
+    if (m_transport == TransportCurlWebSocket)
+    {
+        Connect(urls[0]);   // handshakes are raced on the raw protocol only
+        return;
+    }
+    m_endpoints.assign(urls, urls + count);
+    m_staggerMs = staggerMs;
+    ResetSpool();
+    m_abort = false;
+    m_tls = false;
+    m_ktlsSend = false;
+    m_ktlsRecv = false;
+    m_inboundClosing = false;
+    m_heldBytes = 0;
+    m_heldFrames = 0;
+    ResetInbound();
+    ++m_connThreads;
     std::thread th_conn(ConnProc, this);
     th_conn.detach();
 }
 
+std::vector<WebSocketClientImplCurl::EndpointAttempt> WebSocketClientImplCurl::GetEndpointAttempts()
+{
+    std::lock_guard<std::mutex> lock(m_attemptsMutex);
+    return m_attempts;
+}
+
 void WebSocketClientImplCurl::OnConnect(ConnectResult result)
 {
 }
 
 void WebSocketClientImplCurl::Close()
 {
+    {
+        // Read again, the close handshake has to get through.
+        std::lock_guard<std::mutex> lock(m_inboundMutex);
+        m_inboundClosing = true;
+        m_inboundCond.notify_all();
+    }
+    if (m_tls && !m_ktlsSend && m_transport != TransportCurlWebSocket)
+    {
+        // No way to write a frame. End reading so curl stops at once rather than at its next progress check,
+        // and let it shut TLS down on the socket still open for writing, so the session stays resumable.
+        TimerService& timers = TimerService::Instance();
+        std::lock_guard<std::mutex> lock(timers.mutex);
+        m_abort = true;
+        WakeInbound();
+        if (m_timerMulti)
+            curl_multi_wakeup(m_timerMulti);
+        if (m_timerSocket != CURL_SOCKET_BAD)
+        {
+#ifdef _WIN32
+            shutdown(m_timerSocket, SD_RECEIVE);
+#else
+            shutdown(m_timerSocket, SHUT_RD);
+#endif
+        }
+        return;
+    }
     Message msg(ws::Close, NULL, 0);
     Send(msg);
+    if (m_closeTimeout && GetState() == Connected)
+    {
+        TimerService& timers = TimerService::Instance();
+        std::lock_guard<std::mutex> lock(timers.mutex);
+        if (!TimerWheel::Scheduled(&m_closeTimer))
+            timers.Schedule(&m_closeTimer, m_closeTimeout);
+    }
 }
 
 WebSocketClientImplCurl::State WebSocketClientImplCurl::GetState()
@@ -199,39 +762,28 @@ WebSocketClientImplCurl::State WebSocketClientImplCurl::GetState()
 }
 
 #define FILL_WS_HEADER(endian) \
-        header.endian.fin = true; \
-        header.endian.opcode = msg.type; \
-        if (header.endian.opcode & 0x7) \
+        header.endian.fin = fin; \
+        header.endian.opcode = type; \
+        header.endian.masked = true; /* Client must mask data, including continuation and control frames */\
+        if (len <= 125ULL) \
+        { \
+            header.endian.payloadlen = len; \
+        } \
+        else if (len <= 0xFFFFULL) \
+        { \
+            header.endian.payloadlen = 126; \
+            extendedBtyes = 2; \
+        } \
+        else \
         { \
-            /* Non-control frame */ \
-            header.endian.masked = true; /* Client must mask data */\
-            if (msg.len <= 125ULL) \
-            { \
-                header.endian.payloadlen = msg.len; \
-            } \
-            else if (msg.len <= 0xFFFFULL) \
-            { \
-                header.endian.payloadlen = 126; \
-                extendedBtyes = 2; \
-            } \
-            else \
-            { \
-                header.endian.payloadlen = 127; \
-                extendedBtyes = 8; \
-            } \
+            header.endian.payloadlen = 127; \
+            extendedBtyes = 8; \
         }
 
-int WebSocketClientImplCurl::Send(Message msg)
+// Write frame header, extended length and masking key into @em out, return the bytes written.
+static size_t WriteWsHeader(char* out, FrameType type, bool fin, uint64_t len, const mask& mask_key)
 {
-    if (sendbufflen > sendoffset)
-    {
-        return SendRemaining();
-    }
-
-    if(GetState() != Connected)
-        return -1;
     WsHeader header;
-    size_t header_size = sizeof(WsHeader);
     memset(&header, 0, sizeof(WsHeader));
 
     uint32_t extendedBtyes = 0;
@@ -244,22 +796,7 @@ int WebSocketClientImplCurl::Send(Message msg)
         FILL_WS_HEADER(little)
     }
 
-
-    mask mask_key;
-    int bufflen = sendbufflen = sizeof(WsHeader) + extendedBtyes + sizeof(mask_key) + msg.len;
-    char* buff = sendbuff =(char*)malloc(bufflen);
-
-#ifdef _MSC_VER
-#pragma warning( push )
-#pragma warning(disable: 4302)
-#endif
-    mask_key.integer = (int32_t)buff+1;  // get a random integer
-#ifdef _MSC_VER
-#pragma warning( pop )
-#endif
-    if (!buff)
-        throw "Not enough memory: data is too large.";
-    char* temp = buff;
+    char* temp = out;
     // header
     memcpy(temp, &header, sizeof(header));
     temp += sizeof(header);
@@ -271,14 +808,14 @@ int WebSocketClientImplCurl::Send(Message msg)
         break;
     case 2:
     {
-        uint16_t size = net_to_host((uint16_t)msg.len);
+        uint16_t size = net_to_host((uint16_t)len);
         memcpy(temp, &size, sizeof(size));
         temp += sizeof(size);
         break;
     }
     case 8:
     {
-        uint64_t size = net_to_host((uint64_t)msg.len);
+        uint64_t size = net_to_host((uint64_t)len);
         memcpy(temp, &size, sizeof(size));
         temp += sizeof(size);
         break;
@@ -289,218 +826,2256 @@ int WebSocketClientImplCurl::Send(Message msg)
     memcpy(temp, &mask_key, sizeof(mask_key));
     temp += sizeof(mask_key);
 
-    // payload
-    memcpy(temp, msg.data, msg.len);
-    WsMask(temp, msg.len, mask_key.chararr);
-
-    int n = send(this->m_sockfd, buff, bufflen, 0);
+    return temp - out;
+}
 
-    if (n<0)
+// Size of the masked frame starting at @em frame, header included.
+static uint64_t EncodedFrameSize(const char* frame)
+{
+    uint64_t len = (unsigned char)frame[1] & 0x7f;
+    size_t header_size = 2 + 4;
+    if (len == 126)
     {
-        ClearSendBuff();
-        return -1;
+        uint16_t size;
+        memcpy(&size, frame + 2, sizeof(size));
+        len = net_to_host(size);
+        header_size += sizeof(size);
     }
-
-    if (n < bufflen)
+    else if (len == 127)
     {
-        sendoffset += n;
-        return sendbufflen - sendoffset;
+        uint64_t size;
+        memcpy(&size, frame + 2, sizeof(size));
+        len = net_to_host(size);
+        header_size += sizeof(size);
     }
+    return header_size + len;
+}
 
-    ClearSendBuff();
-    return 0;
+int64_t WebSocketClientImplCurl::Send(Message msg)
+{
+    bool taken;
+    return Send(msg, taken);
 }
 
-int ws::WebSocketClientImplCurl::SendRemaining()
+int64_t WebSocketClientImplCurl::Send(Message msg, bool& taken)
 {
-    if (sendbufflen > sendoffset)
+    WS_TRACE_SCOPE(send, msg.len);
+    taken = false;
+    if (m_coalesceDelay && !(msg.type & 0x8) && !m_spool && m_transport != TransportCurlWebSocket)
     {
-        int n = send(this->m_sockfd, this->sendbuff, sendoffset, sendbufflen - sendoffset);
-        if (n < 0)
-        {
-            ClearSendBuff();
+        int64_t remaining = SendCoalesced(msg);
+        taken = remaining >= 0;
+        return remaining;
+    }
+    std::lock_guard<std::mutex> lock(m_sendMutex);
+
+    if (msg.type & 0x8)
+    {
+        if (!QueueControl(msg))
             return -1;
-        }
-        sendoffset += n;
-        if (sendbufflen > sendoffset)
-        {
-            return sendbufflen - sendoffset;
-        }
-        else
-        {
-            ClearSendBuff();
-        }
+        taken = true;
+        return SendPending();
     }
-    return 0;
-}
 
-void WebSocketClientImplCurl::OnRecv(Message msg, bool fin)
-{
+    if (m_spool)
+    {
+        int64_t remaining = m_transport == TransportCurlWebSocket ? -1 : SpoolMessage(msg);
+        taken = remaining >= 0;
+        return remaining;
+    }
 
-}
+    if (sendbufflen > sendoffset || m_stream || m_wsSending)
+    {
+        return SendPending();
+    }
 
-long WebSocketClientImplCurl::GetResponseCode()
-{
-    long response_code = 0;
-    curl_easy_getinfo(m_curl, CURLINFO_RESPONSE_CODE, &response_code);
-    return response_code;
+    if(GetState() != Connected)
+        return -1;
+
+    if (!LoadMessage(msg))
+        return -1;
+    taken = true;
+    return SendPending();
 }
 
-curl_socket_t WebSocketClientImplCurl::OpenSocketCallback(void * clientp, curlsocktype purpose, curl_sockaddr * address)
+// Encode a control frame to go out at the next frame boundary, the caller must hold m_sendMutex.
+bool WebSocketClientImplCurl::QueueControl(Message msg)
 {
-    curl_socket_t *sockfd = &((WebSocketClientImplCurl *)clientp)->m_sockfd;
-    *sockfd = socket(address->family, address->socktype, address->protocol);
-    return *sockfd;
+    if (msg.len > 125 || GetState() != Connected)
+        return false;
+    char frame[MAX_WS_HEADER_SIZE + 125];
+    size_t frame_size;
+    if (m_transport == TransportCurlWebSocket)
+    {
+        // curl frames it, keep the type, length and payload.
+        frame[0] = (char)msg.type;
+        frame[1] = (char)msg.len;
+        if (msg.len)
+            memcpy(frame + 2, msg.data, msg.len);
+        frame_size = 2 + msg.len;
+    }
+    else
+    {
+        mask mask_key;
+        mask_key.integer = NewMaskKey();
+        size_t header_size = WriteWsHeader(frame, msg.type, true, msg.len, mask_key);
+        WsMaskCopy(frame + header_size, msg.data, msg.len, mask_key.chararr);
+        frame_size = header_size + msg.len;
+    }
+    if (msg.type == ws::Close && (sendbufflen > sendoffset || m_stream || m_batchLen || m_wsSending || SpoolUnsent()))
+        m_closeFrame.append(frame, frame_size);  // no data frame may follow a close frame
+    else
+        m_control.append(frame, frame_size);
+    return true;
 }
 
-size_t WebSocketClientImplCurl::OnHeaderReceived(char * buffer, size_t size, size_t nitems, void * userdata)
+// Encode @em msg into the send buffer, or start streaming it by fragments. Nothing may be in flight.
+bool WebSocketClientImplCurl::LoadMessage(Message msg)
 {
-    size_t n = size * nitems;
-    if (buffer[0] == 'H' && buffer[1] == 'T' && buffer[2] == 'T' && buffer[3] == 'P')
+    if (m_transport == TransportCurlWebSocket)
     {
-        WebSocketClientImplCurl *pthis = (WebSocketClientImplCurl *)userdata;
-        long code = pthis->GetResponseCode();
+        // The bare payload, curl frames and masks it as it sends it.
+        char* buff = (char*)malloc(msg.len ? msg.len : 1);
+        if (!buff)
+            throw "Not enough memory: data is too large.";
+        if (msg.len)
+            memcpy(buff, msg.data, msg.len);
+        sendbuff = buff;
+        sendbufflen = msg.len;
+        sendoffset = 0;
+        m_wsType = msg.type;
+        m_wsSending = true;
+        m_sendFrames = 1;
+        return true;
+    }
 
-        if (code == 101)
-        {
-            pthis->SetState(Connected);
-            pthis->OnConnect(Success);
-        }
-        else
+    if (m_maxFrameSize && msg.len > m_maxFrameSize)
+    {
+        OutboundStream* stream = NewStream(msg.type, msg.len);
+        stream->copy = (char*)malloc(msg.len);
+        if (!stream->copy)
         {
-            pthis->SetState(Disconnected);
-            pthis->OnConnect(Reject);
+            ReleaseStream(stream);
+            throw "Not enough memory: data is too large.";
         }
+        memcpy(stream->copy, msg.data, msg.len);
+        stream->data = stream->copy;
+        return LoadStream(stream);
     }
-    return n;
-}
 
-#define CHECK_REMAINING(size) \
-        if(remaining < size) \
-        { \
-            pthis->buffer = std::string(start, len); \
-            return datalen; \
+    char* buff = (char*)malloc(MAX_WS_HEADER_SIZE + msg.len);
+    if (!buff)
+        throw "Not enough memory: data is too large.";
+
+    mask mask_key;
+    mask_key.integer = NewMaskKey();
+    size_t header_size = WriteWsHeader(buff, msg.type, true, msg.len, mask_key);
+
+    // payload
+    WsMaskCopy(buff + header_size, msg.data, msg.len, mask_key.chararr);
+
+    sendbuff = buff;
+    sendbufflen = header_size + msg.len;
+    sendoffset = 0;
+    m_sendFrames = 1;
+    WS_TRACE_COUNTER(send_buffer, sendbufflen);
+    return true;
+}
+
+// Steady clock in microseconds, times the frames held by SetWriteCoalescing().
+static uint64_t NowUs()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Send() while coalescing: add a data frame to the held ones, and write them if they are due.
+int64_t WebSocketClientImplCurl::SendCoalesced(Message msg)
+{
+    int64_t remaining;
+    {
+        std::lock_guard<std::mutex> lock(m_sendMutex);
+        if (GetState() != Connected)
+            return -1;
+        bool busy = sendbufflen > sendoffset || m_stream;
+        if (m_maxFrameSize && msg.len > m_maxFrameSize)
+        {
+            // Fragmented, goes on its own once nothing else is waiting.
+            if (busy || m_batchLen || !m_conflated.empty() || !LoadMessage(msg))
+                return -1;
+            return SendPending();
+        }
+        if (busy && m_batchLen >= m_coalesceBytes)
+            return -1;  // enough is held already, the socket has to catch up
+
+        size_t needed = m_batchLen + MAX_WS_HEADER_SIZE + msg.len;
+        if (needed > m_batchCap)
+        {
+            size_t cap = std::max(needed, m_batchCap * 2);
+            char* batch = (char*)realloc(m_batch, cap);
+            if (!batch)
+                throw "Not enough memory: data is too large.";
+            m_batch = batch;
+            m_batchCap = cap;
+        }
+        mask mask_key;
+        mask_key.integer = NewMaskKey();
+        size_t header_size = WriteWsHeader(m_batch + m_batchLen, msg.type, true, msg.len, mask_key);
+        WsMaskCopy(m_batch + m_batchLen + header_size, msg.data, msg.len, mask_key.chararr);
+        m_batchLen += header_size + msg.len;
+        ++m_batchFrames;
+        remaining = SendPending();
+        if (remaining <= 0 || !m_batchLen)
+            return remaining;
+    }
+    ArmFlushTimer();    // not under the send lock, which is not held while waiting for the timer lock
+    return remaining;
+}
+
+// Whether the held frames have to be written now rather than wait for more.
+bool WebSocketClientImplCurl::FlushDue()
+{
+    return m_batchLen >= m_coalesceBytes || !m_closeFrame.empty() ||
+           NowUs() - m_lastFlush >= m_coalesceDelay;
+}
+
+// Hand the held frames to the send buffer, to go out in one write.
+void WebSocketClientImplCurl::LoadBatch()
+{
+    sendbuff = m_batch;
+    sendbufflen = m_batchLen;
+    sendoffset = 0;
+    m_batch = NULL;
+    m_batchLen = 0;
+    m_batchCap = 0;
+    m_sendFrames = m_batchFrames;
+    m_stats.coalesced += m_batchFrames - 1;
+    m_batchFrames = 0;
+    m_lastFlush = NowUs();
+    WS_TRACE_COUNTER(send_buffer, sendbufflen);
+}
+
+// Make sure the held frames go out even if the application does not call SendRemaining().
+void WebSocketClientImplCurl::ArmFlushTimer()
+{
+    TimerService& timers = TimerService::Instance();
+    std::lock_guard<std::mutex> lock(timers.mutex);
+    if (!TimerWheel::Scheduled(&m_flushTimer))
+        timers.Schedule(&m_flushTimer, (m_coalesceDelay + 999) / 1000 + 1);  // the wheel rounds down a tick
+}
+
+int64_t WebSocketClientImplCurl::SendConflated(uint64_t key, Message msg)
+{
+    if (msg.type & 0x8)
+        return Send(msg);
+
+    std::lock_guard<std::mutex> lock(m_sendMutex);
+    if (GetState() != Connected || m_spool)
+        return -1;
+    if (sendbufflen > sendoffset || m_stream || m_batchLen || m_wsSending)
+    {
+        // Busy, wait in the queue, in place of an older value of the same key.
+        std::unordered_map<uint64_t, ConflatedList::iterator>::iterator it = m_conflatedKeys.find(key);
+        if (it != m_conflatedKeys.end())
+        {
+            m_conflatedBytes -= it->second->payload.size();
+            it->second->type = msg.type;
+            it->second->payload.assign(msg.data, msg.len);
+            ++m_stats.conflated;
+        }
+        else
+        {
+            m_conflated.push_back(ConflatedMessage());
+            m_conflated.back().key = key;
+            m_conflated.back().type = msg.type;
+            m_conflated.back().payload.assign(msg.data, msg.len);
+            m_conflatedKeys[key] = --m_conflated.end();
+            m_conflatedBytes += MAX_WS_HEADER_SIZE;
+        }
+        m_conflatedBytes += msg.len;
+        return SendPending();
+    }
+
+    if (!LoadMessage(msg))
+        return -1;
+    return SendPending();
+}
+
+size_t WebSocketClientImplCurl::Broadcast(Message msg, WebSocketClientImplCurl* const* clients, size_t count,
+                                          bool sharedMaskKey)
+{
+    // One frame is encoded into the scratch buffer, only its masking key and payload change between clients.
+    std::vector<char> frame(MAX_WS_HEADER_SIZE + msg.len);
+    mask mask_key;
+    mask_key.integer = NewMaskKey();
+    size_t header_size = WriteWsHeader(frame.data(), msg.type, true, msg.len, mask_key);
+    size_t frame_size = header_size + msg.len;
+    char* key = frame.data() + header_size - sizeof(mask_key);
+    bool masked = false;
+
+    size_t taken = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        WebSocketClientImplCurl* client = clients[i];
+        if ((msg.type & 0x8) || (client->m_maxFrameSize && msg.len > client->m_maxFrameSize) ||
+            client->m_transport == TransportCurlWebSocket)
+        {
+            if (client->Send(msg) >= 0)
+                ++taken;
+            continue;
+        }
+        if (!sharedMaskKey || !masked)
+        {
+            if (!sharedMaskKey)
+            {
+                mask_key.integer = NewMaskKey();
+                memcpy(key, &mask_key, sizeof(mask_key));
+            }
+            WsMaskCopy(frame.data() + header_size, msg.data, msg.len, mask_key.chararr);
+            masked = true;
+        }
+        std::lock_guard<std::mutex> lock(client->m_sendMutex);
+        if (client->SendEncoded(frame.data(), frame_size) >= 0)
+            ++taken;
+    }
+    return taken;
+}
+
+// Send a complete encoded data frame, keeping a copy of what the socket did not take. The caller must hold
+// m_sendMutex.
+int64_t WebSocketClientImplCurl::SendEncoded(const char* frame, size_t len)
+{
+    if (sendbufflen > sendoffset || m_stream || m_batchLen || m_spool || m_transport == TransportCurlWebSocket ||
+        GetState() != Connected)
+        return -1;
+
+    // Pending control frames go first, as in SendPending().
+    const char* pieces[2];
+    size_t lens[2];
+    int count = 0;
+    size_t control = m_control.size();
+    if (control)
+    {
+        pieces[count] = m_control.data();
+        lens[count++] = control;
+    }
+    pieces[count] = frame;
+    lens[count++] = len;
+    int64_t n = SendPieces(pieces, lens, count);
+    if (n < 0)
+    {
+        AbortSend();
+        return -1;
+    }
+    size_t sentControl = std::min<size_t>((size_t)n, control);
+    ControlWritten(sentControl);
+    size_t sent = (size_t)n - sentControl;
+    if (sent == len)
+        ++m_stats.framesSent;
+    else
+    {
+        sendbuff = (char*)malloc(len - sent);
+        if (!sendbuff)
+            throw "Not enough memory: data is too large.";
+        memcpy(sendbuff, frame + sent, len - sent);
+        sendbufflen = len - sent;
+        sendoffset = 0;
+        m_sendFrames = 1;
+        WS_TRACE_COUNTER(send_buffer, sendbufflen);
+    }
+    return sendbufflen - sendoffset + m_control.size();
+}
+
+void WebSocketClientImplCurl::SetMaxFrameSize(size_t size)
+{
+    std::lock_guard<std::mutex> lock(m_sendMutex);
+    m_maxFrameSize = size;
+}
+
+void WebSocketClientImplCurl::SetWriteCoalescing(unsigned delayUs, size_t maxBytes)
+{
+    std::lock_guard<std::mutex> lock(m_sendMutex);
+    m_coalesceDelay = delayUs;
+    m_coalesceBytes = maxBytes;
+}
+
+WebSocketClientImplCurl::OutboundStream* WebSocketClientImplCurl::NewStream(FrameType type, uint64_t len)
+{
+    OutboundStream* stream = new OutboundStream();
+    stream->read = NULL;
+    stream->opaque = NULL;
+    stream->data = NULL;
+    stream->mapped = false;
+    stream->copy = NULL;
+    stream->file = NULL;
+    stream->len = len;
+    stream->offset = 0;
+    stream->chunk = m_maxFrameSize ? m_maxFrameSize : streamChunkSize;
+    stream->type = type;
+    return stream;
+}
+
+void WebSocketClientImplCurl::ReleaseStream(OutboundStream* stream)
+{
+#ifndef _WIN32
+    if (stream->mapped)
+        munmap((void*)stream->data, stream->len);
+#endif
+    free(stream->copy);
+    if (stream->file)
+        fclose(stream->file);
+    delete stream;
+}
+
+static size_t ReadFileCallback(char* buffer, size_t size, void* opaque)
+{
+    return fread(buffer, 1, size, (FILE*)opaque);
+}
+
+int64_t WebSocketClientImplCurl::SendStream(StreamReadCallback read, void* opaque, uint64_t len, FrameType type)
+{
+    std::lock_guard<std::mutex> lock(m_sendMutex);
+    OutboundStream* stream = NewStream(type, len);
+    stream->read = read;
+    stream->opaque = opaque;
+    return StartStream(stream);
+}
+
+int64_t WebSocketClientImplCurl::SendFile(const char* path)
+{
+    std::lock_guard<std::mutex> lock(m_sendMutex);
+    if (sendbufflen > sendoffset || m_stream || m_batchLen || m_spool || m_transport == TransportCurlWebSocket ||
+        GetState() != Connected)
+        return -1;
+
+    OutboundStream* stream = NewStream(Binary, 0);
+
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        void* addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED)
+        {
+            madvise(addr, st.st_size, MADV_SEQUENTIAL);
+            stream->data = (const char*)addr;
+            stream->mapped = true;
+            stream->len = st.st_size;
+        }
+    }
+    if (fd >= 0)
+        close(fd);
+#endif
+
+    if (!stream->data)
+    {
+        // Not mapped, read it through stdio instead.
+        stream->file = fopen(path, "rb");
+        if (!stream->file)
+        {
+            ReleaseStream(stream);
+            return -1;
+        }
+        fseek(stream->file, 0, SEEK_END);
+        stream->len = ftell(stream->file);
+        fseek(stream->file, 0, SEEK_SET);
+        stream->read = ReadFileCallback;
+        stream->opaque = stream->file;
+    }
+    return StartStream(stream);
+}
+
+int64_t WebSocketClientImplCurl::StartStream(OutboundStream* stream)
+{
+    if (sendbufflen > sendoffset || m_stream || m_batchLen || m_spool || m_transport == TransportCurlWebSocket ||
+        GetState() != Connected)
+    {
+        ReleaseStream(stream);
+        return -1;
+    }
+
+    if (!LoadStream(stream))
+        return -1;
+    return SendPending();
+}
+
+// Make @em stream the message in flight and build its first fragment.
+bool WebSocketClientImplCurl::LoadStream(OutboundStream* stream)
+{
+    sendbuff = (char*)malloc(MAX_WS_HEADER_SIZE + stream->chunk);
+    if (!sendbuff)
+    {
+        ReleaseStream(stream);
+        throw "Not enough memory.";
+    }
+    m_stream = stream;
+    WS_TRACE_COUNTER(send_buffer, MAX_WS_HEADER_SIZE + stream->chunk);
+    if (!FillStreamFrame())
+    {
+        AbortSend();
+        return false;
+    }
+    return true;
+}
+
+// Build the next fragment of the streamed message into the send buffer.
+bool WebSocketClientImplCurl::FillStreamFrame()
+{
+    OutboundStream* stream = m_stream;
+    uint64_t offset = stream->offset;
+    size_t chunk = (size_t)std::min<uint64_t>(stream->len - offset, stream->chunk);
+    FrameType type = offset == 0 ? stream->type : Continuation;
+    bool fin = offset + chunk == stream->len;
+
+    mask mask_key;
+    mask_key.integer = NewMaskKey();
+    size_t header_size = WriteWsHeader(sendbuff, type, fin, chunk, mask_key);
+    char* payload = sendbuff + header_size;
+    if (stream->data)
+    {
+        WsMaskCopy(payload, stream->data + offset, chunk, mask_key.chararr);
+#ifndef _WIN32
+        // Sent pages are not needed anymore, keep the resident size bounded.
+        if (stream->mapped)
+            madvise((void*)(stream->data + offset), chunk, MADV_DONTNEED);
+#endif
+    }
+    else
+    {
+        size_t n = 0;
+        while (n < chunk)
+        {
+            size_t ret = stream->read(payload + n, chunk - n, stream->opaque);
+            if (ret == 0)
+                return false;   // the stream ended before @em len bytes
+            n += ret;
+        }
+        WsMask(payload, chunk, mask_key.chararr);
+    }
+
+    stream->offset += chunk;
+    sendbufflen = header_size + chunk;
+    sendoffset = 0;
+    m_sendFrames = 1;
+    return true;
+}
+
+int64_t ws::WebSocketClientImplCurl::SendRemaining()
+{
+    WS_TRACE_SCOPE(send_remaining, 0);
+    std::lock_guard<std::mutex> lock(m_sendMutex);
+    return SendPending();
+}
+
+bool WebSocketClientImplCurl::SetSpoolFile(const char* path, uint64_t capacity, bool manualAck)
+{
+    std::lock_guard<std::mutex> lock(m_sendMutex);
+    if (m_sendFromSpool)
+        ClearSendBuff();
+    CloseSpool();
+    if (!path)
+        return true;
+#ifdef _WIN32
+    return false;
+#else
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    SpoolHeader header;
+    bool existing = fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(header) &&
+                    pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+                    memcmp(header.magic, SPOOL_MAGIC, sizeof(header.magic)) == 0;
+    if (existing)
+    {
+        // Reopened after a restart, check the offsets before trusting them.
+        capacity = header.capacity;
+        if ((uint64_t)st.st_size < spoolHeaderSize + capacity || header.base > header.ack ||
+            header.ack > header.write || header.write - header.base > capacity)
+        {
+            close(fd);
+            return false;
+        }
+    }
+    else if (ftruncate(fd, 0) != 0 || ftruncate(fd, spoolHeaderSize + capacity) != 0)
+    {
+        close(fd);
+        return false;
+    }
+    size_t size = (size_t)(spoolHeaderSize + capacity);
+    void* addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);  // the mapping keeps the file
+    if (addr == MAP_FAILED)
+        return false;
+
+    m_spool = (SpoolHeader*)addr;
+    m_spoolData = (char*)addr + spoolHeaderSize;
+    m_spoolMapped = size;
+    if (!existing)
+    {
+        m_spool->capacity = capacity;
+        m_spool->base = 0;
+        m_spool->write = 0;
+        m_spool->ack = 0;
+        memcpy(m_spool->magic, SPOOL_MAGIC, sizeof(m_spool->magic));
+    }
+    m_spoolSent = m_spool->ack;
+    m_spoolManualAck = manualAck;
+    return true;
+#endif
+}
+
+uint64_t WebSocketClientImplCurl::GetSpoolOffset()
+{
+    std::lock_guard<std::mutex> lock(m_sendMutex);
+    return m_spool ? m_spool->write : 0;
+}
+
+void WebSocketClientImplCurl::AcknowledgeSpool(uint64_t offset)
+{
+    std::lock_guard<std::mutex> lock(m_sendMutex);
+    if (m_spool && offset > m_spool->ack)
+        AckSpool(std::min(offset, m_spool->write));
+}
+
+void WebSocketClientImplCurl::AckSpool(uint64_t offset)
+{
+    m_spool->ack = offset;
+    if (m_spool->ack == m_spool->write && !m_sendFromSpool)
+        m_spool->base = m_spool->write;     // all delivered, start over at the beginning of the file
+}
+
+// Encode a data message at the end of the spool, fragmented as by Send(). The caller must hold m_sendMutex.
+int64_t WebSocketClientImplCurl::SpoolMessage(Message msg)
+{
+    size_t chunk = m_maxFrameSize && msg.len > m_maxFrameSize ? m_maxFrameSize : msg.len;
+    size_t frames = chunk ? (msg.len + chunk - 1) / chunk : 1;
+    uint64_t needed = (uint64_t)frames * MAX_WS_HEADER_SIZE + msg.len;
+    SpoolHeader* spool = m_spool;
+    if (spool->write - spool->base + needed > spool->capacity && !m_sendFromSpool && spool->ack > spool->base)
+    {
+        // Discard the delivered frames, nothing points into the spool meanwhile.
+        memmove(m_spoolData, m_spoolData + (spool->ack - spool->base), (size_t)(spool->write - spool->ack));
+        spool->base = spool->ack;
+    }
+    if (spool->write - spool->base + needed > spool->capacity)
+        return -1;
+
+    // Frames first, then the offset, so a crash never exposes a half-written frame.
+    char* out = m_spoolData + (spool->write - spool->base);
+    size_t offset = 0;
+    do
+    {
+        size_t len = std::min(chunk, msg.len - offset);
+        bool fin = offset + len == msg.len;
+        mask mask_key;
+        mask_key.integer = NewMaskKey();
+        size_t header_size = WriteWsHeader(out, offset == 0 ? msg.type : Continuation, fin, len, mask_key);
+        WsMaskCopy(out + header_size, msg.data + offset, len, mask_key.chararr);
+        out += header_size + len;
+        offset += len;
+    } while (offset < msg.len);
+    std::atomic_signal_fence(std::memory_order_release);
+    spool->write = spool->base + (out - m_spoolData);
+
+    if (GetState() != Connected)
+        return (int64_t)SpoolUnsent();  // sent after the next Connect()
+    return SendPending();
+}
+
+// Point the send buffer at the spooled frames not handed to the socket yet, return false if there are none.
+bool WebSocketClientImplCurl::LoadSpool()
+{
+    if (m_spoolSent >= m_spool->write || GetState() != Connected)
+        return false;
+    sendbuff = m_spoolData + (m_spoolSent - m_spool->base);
+    sendbufflen = (size_t)(m_spool->write - m_spoolSent);
+    sendoffset = 0;
+    m_sendFrames = 0;
+    for (size_t offset = 0; offset < sendbufflen; offset += (size_t)EncodedFrameSize(sendbuff + offset))
+        ++m_sendFrames;
+    m_sendFromSpool = true;
+    m_spoolSent = m_spool->write;
+    WS_TRACE_COUNTER(send_buffer, sendbufflen);
+    return true;
+}
+
+// Start sending from the acknowledged offset again, for a new connection.
+void WebSocketClientImplCurl::ResetSpool()
+{
+    std::lock_guard<std::mutex> lock(m_sendMutex);
+    if (!m_spool)
+        return;
+    if (m_sendFromSpool)
+        ClearSendBuff();
+    m_spoolSent = m_spool->ack;
+}
+
+void WebSocketClientImplCurl::CloseSpool()
+{
+#ifndef _WIN32
+    if (m_spool)
+        munmap(m_spool, m_spoolMapped);
+#endif
+    m_spool = NULL;
+    m_spoolData = NULL;
+    m_spoolMapped = 0;
+}
+
+// Spooled bytes not handed to the send buffer yet.
+uint64_t WebSocketClientImplCurl::SpoolUnsent()
+{
+    return m_spool ? m_spool->write - m_spoolSent : 0;
+}
+
+// Send @em pieces in order as far as the socket takes them, return the bytes sent or -1 on failure.
+int64_t WebSocketClientImplCurl::SendPieces(const char** pieces, const size_t* lens, int count)
+{
+    if (m_tls && !m_ktlsSend)
+        return -1;  // the TLS record layer belongs to curl, plain frames would break the stream
+    int64_t total = 0;
+#ifdef WEBSOCKET_CLIENT_IO_URING
+    if (m_sendRing)
+    {
+        // One gathering send per call, pieces must not be reordered by a short send.
+        struct iovec iov[2];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        for (int i = 0; i < count; ++i)
+        {
+            iov[i].iov_base = (void*)pieces[i];
+            iov[i].iov_len = lens[i];
+        }
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+
+        io_uring_sqe* sqe = m_sendRing->GetSqe();
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = m_sockfd;
+        sqe->addr = (uint64_t)(uintptr_t)&msg;
+        sqe->msg_flags = MSG_DONTWAIT | SEND_FLAGS;
+        uint64_t before = m_sendRing->EnterCalls();
+        bool submitted = m_sendRing->Submit(1);
+        m_stats.sendCalls += m_sendRing->EnterCalls() - before;
+        io_uring_cqe* cqe = submitted ? m_sendRing->PeekCqe() : NULL;
+        if (!cqe)
+            return -1;
+        int res = cqe->res;
+        m_sendRing->SeenCqe();
+        if (res < 0)
+            return res == -EAGAIN ? 0 : -1;
+        m_stats.bytesSent += res;
+        return res;
+    }
+#endif
+#ifndef _WIN32
+    if (count > 1)
+    {
+        // Gather the pieces into one write, so control frames share a segment with the data.
+        struct iovec iov[2];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        for (int i = 0; i < count; ++i)
+        {
+            iov[i].iov_base = (void*)pieces[i];
+            iov[i].iov_len = lens[i];
+        }
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        int64_t n = sendmsg(m_sockfd, &msg, SEND_FLAGS);
+        ++m_stats.sendCalls;
+        if (n < 0)
+            return SocketWouldBlock() ? 0 : -1;
+        m_stats.bytesSent += n;
+        return n;
+    }
+#endif
+    for (int i = 0; i < count; ++i)
+    {
+        int64_t n = send(this->m_sockfd, pieces[i], lens[i], SEND_FLAGS);
+        ++m_stats.sendCalls;
+        if (n < 0)
+        {
+            if (SocketWouldBlock())
+                break;
+            return total ? total : -1;
+        }
+        total += n;
+        m_stats.bytesSent += n;
+        if ((size_t)n < lens[i])
+            break;  // socket buffer is full
+    }
+    return total;
+}
+
+// Load the next message of SendConflated(), the latest value of its key. Nothing may be in flight.
+bool WebSocketClientImplCurl::LoadConflated()
+{
+    ConflatedMessage next;
+    next.type = m_conflated.front().type;
+    next.payload.swap(m_conflated.front().payload);
+    m_conflatedKeys.erase(m_conflated.front().key);
+    m_conflated.pop_front();
+    m_conflatedBytes -= MAX_WS_HEADER_SIZE + next.payload.size();
+    return LoadMessage(Message(next.type, next.payload.data(), next.payload.size()));
+}
+
+// Flush the outbound data as far as possible, the caller must hold m_sendMutex. Without @em pullStream the
+// next fragment of a streamed message is left to the application's thread, control frames go before it.
+int64_t WebSocketClientImplCurl::SendPending(bool pullStream)
+{
+    if (m_pingDue.load(std::memory_order_relaxed) && m_pingDue.exchange(false))
+        QueueControl(Message(Ping, NULL, 0));   // the ping timer expired while another thread was sending
+    if (m_transport == TransportCurlWebSocket)
+        return SendPendingCurlWs();
+    for (;;)
+    {
+        bool held = false;  // a streamed message waits for its next fragment
+        if (sendbufflen > 0 && sendoffset == sendbufflen)
+        {
+            // The current frame is on the wire, build the next fragment or finish the message.
+            if (m_stream && m_stream->offset < m_stream->len)
+            {
+                if (!pullStream)
+                    held = true;
+                else if (!FillStreamFrame())
+                {
+                    AbortSend();
+                    return -1;
+                }
+            }
+            else if (m_sendFromSpool)
+            {
+                // The spooled frames are in the socket, go on with those spooled meanwhile.
+                ClearSendBuff();
+                if (!m_spoolManualAck)
+                    AckSpool(m_spoolSent);
+                if (!LoadSpool())
+                {
+                    m_control.append(m_closeFrame);
+                    m_closeFrame.clear();
+                }
+            }
+            else if (!m_conflated.empty())
+            {
+                ClearSendBuff();
+                if (!LoadConflated())
+                    return -1;
+            }
+            else
+            {
+                ClearSendBuff();
+                if (!m_batchLen)
+                {
+                    m_control.append(m_closeFrame);
+                    m_closeFrame.clear();
+                }
+            }
+        }
+
+        if (sendbufflen == 0 && !m_stream && m_spool)
+            LoadSpool();    // frames spooled while nothing was in flight
+        if (sendbufflen == 0 && !m_stream && m_batchLen && FlushDue())
+            LoadBatch();    // frames held by SetWriteCoalescing()
+
+        // Control frames are slotted in between data frames.
+        const char* pieces[2];
+        size_t lens[2];
+        int count = 0;
+        size_t control = sendoffset == 0 || held ? m_control.size() : 0;
+        if (control)
+        {
+            pieces[count] = m_control.data();
+            lens[count++] = control;
+        }
+        if (sendbufflen > sendoffset)
+        {
+            pieces[count] = sendbuff + sendoffset;
+            lens[count++] = sendbufflen - sendoffset;
+        }
+        if (count == 0)
+            break;  // nothing left
+
+        int64_t n = SendPieces(pieces, lens, count);
+        if (n < 0)
+        {
+            AbortSend();
+            return -1;
+        }
+        size_t sentControl = std::min<size_t>((size_t)n, control);
+        ControlWritten(sentControl);
+        sendoffset += (size_t)n - sentControl;
+        if (sendoffset == sendbufflen)
+        {
+            m_stats.framesSent += m_sendFrames;
+            m_sendFrames = 0;
+        }
+        if (!m_control.empty() || sendbufflen > sendoffset)
+        {
+            WS_TRACE_INSTANT(partial_send, sendbufflen - sendoffset + m_control.size());
+            break;  // socket buffer is full
+        }
+        if (held)
+            break;
+    }
+
+    int64_t remaining = sendbufflen - sendoffset + m_control.size() + m_closeFrame.size();
+    if (m_stream)
+        remaining += m_stream->len - m_stream->offset;
+    return remaining + m_conflatedBytes + m_batchLen + SpoolUnsent();
+}
+
+// Drop the first @em n bytes of m_control, which were written, and count the frames they finish.
+void WebSocketClientImplCurl::ControlWritten(size_t n)
+{
+    size_t offset = 0;
+    while (offset < n)
+    {
+        size_t left = m_controlLeft ? m_controlLeft : (size_t)EncodedFrameSize(m_control.data() + offset);
+        if (n - offset < left)
+        {
+            m_controlLeft = left - (n - offset);
+            break;
+        }
+        offset += left;
+        m_controlLeft = 0;
+        ++m_stats.framesSent;
+    }
+    m_control.erase(0, n);
+}
+
+#ifdef WEBSOCKET_CLIENT_CURL_WS
+static unsigned CurlWsFlags(FrameType type)
+{
+    switch (type)
+    {
+    case Text:
+        return CURLWS_TEXT;
+    case Close:
+        return CURLWS_CLOSE;
+    case Ping:
+        return CURLWS_PING;
+    case Pong:
+        return CURLWS_PONG;
+    default:
+        return CURLWS_BINARY;
+    }
+}
+#endif
+
+// SendPending() of TransportCurlWebSocket, curl frames the payloads and encrypts them on wss:// connections.
+// Control frames go between messages, a message started is finished first.
+int64_t WebSocketClientImplCurl::SendPendingCurlWs()
+{
+#ifdef WEBSOCKET_CLIENT_CURL_WS
+    for (;;)
+    {
+        if (!m_wsSending && !m_control.empty())
+        {
+            FrameType type = (FrameType)m_control[0];
+            size_t len = (unsigned char)m_control[1];
+            size_t sent = 0;
+            CURLcode res = curl_ws_send(m_curl, m_control.data() + 2, len, &sent, 0, CurlWsFlags(type));
+            ++m_stats.sendCalls;
+            if (res == CURLE_AGAIN)
+                break;
+            if (res != CURLE_OK)
+            {
+                AbortSend();
+                return -1;
+            }
+            m_stats.bytesSent += len;
+            ++m_stats.framesSent;
+            m_control.erase(0, 2 + len);
+            continue;
+        }
+        if (!m_wsSending)
+        {
+            if (!m_conflated.empty())
+            {
+                if (!LoadConflated())
+                    return -1;
+                continue;
+            }
+            if (m_closeFrame.empty())
+                break;  // nothing left
+            m_control.append(m_closeFrame);
+            m_closeFrame.clear();
+            continue;
+        }
+
+        size_t sent = 0;
+        CURLcode res = curl_ws_send(m_curl, sendbuff + sendoffset, sendbufflen - sendoffset, &sent, 0,
+                                    CurlWsFlags(m_wsType));
+        ++m_stats.sendCalls;
+        if (res != CURLE_OK && res != CURLE_AGAIN)
+        {
+            AbortSend();
+            return -1;
+        }
+        sendoffset += sent;
+        m_stats.bytesSent += sent;
+        if (res == CURLE_AGAIN || sendoffset < sendbufflen)
+        {
+            WS_TRACE_INSTANT(partial_send, sendbufflen - sendoffset);
+            break;  // socket buffer is full
+        }
+        m_stats.framesSent += m_sendFrames;
+        ClearSendBuff();
+    }
+#endif
+    int64_t remaining = sendbufflen - sendoffset + m_control.size() + m_closeFrame.size() + m_conflatedBytes;
+    if (m_wsSending && remaining == 0)
+        remaining = 1;  // an empty message is still waiting
+    return remaining;
+}
+
+void WebSocketClientImplCurl::OnRecv(Message msg, bool fin)
+{
+
+}
+
+void WebSocketClientImplCurl::OnDisconnect()
+{
+}
+
+CURL* WebSocketClientImplCurl::GetCurlHandle()
+{
+    return m_curl;
+}
+
+curl_socket_t WebSocketClientImplCurl::GetSocket()
+{
+    return m_sockfd;
+}
+
+long WebSocketClientImplCurl::GetResponseCode()
+{
+    long response_code = 0;
+    curl_easy_getinfo(m_curl, CURLINFO_RESPONSE_CODE, &response_code);
+    return response_code;
+}
+
+curl_socket_t WebSocketClientImplCurl::OpenSocketCallback(void * clientp, curlsocktype purpose, curl_sockaddr * address)
+{
+    WebSocketClientImplCurl *pthis = (WebSocketClientImplCurl *)clientp;
+    pthis->m_sockfd = pthis->OpenSocket(address);
+    pthis->SetTimerSocket(pthis->m_sockfd);
+    return pthis->m_sockfd;
+}
+
+// Create the socket for curl, with the options selected for the connection.
+curl_socket_t WebSocketClientImplCurl::OpenSocket(curl_sockaddr* address)
+{
+    curl_socket_t sockfd = socket(address->family, address->socktype, address->protocol);
+#ifdef __linux__
+    if (m_timestamps && sockfd != CURL_SOCKET_BAD)
+    {
+        int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+        if (setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) != 0)
+        {
+            int on = 1;
+            setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+        }
+    }
+    if (m_busyPoll && m_socketBusyPoll && sockfd != CURL_SOCKET_BAD)
+    {
+        // Raising it above net.core.busy_read needs CAP_NET_ADMIN, spinning works without it anyway.
+        int usec = (int)m_socketBusyPoll;
+        setsockopt(sockfd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec));
+    }
+#endif
+    return sockfd;
+}
+
+size_t WebSocketClientImplCurl::OnHeaderReceived(char * buffer, size_t size, size_t nitems, void * userdata)
+{
+    size_t n = size * nitems;
+    if (buffer[0] == 'H' && buffer[1] == 'T' && buffer[2] == 'T' && buffer[3] == 'P')
+    {
+        WebSocketClientImplCurl *pthis = (WebSocketClientImplCurl *)userdata;
+        long code = pthis->GetResponseCode();
+
+        WS_TRACE_INSTANT(handshake, code);
+        if (pthis->m_transport == TransportCurlWebSocket)
+        {
+            // Reported once curl_easy_perform() returned, the connection is not usable before.
+            if (code == 101)
+                pthis->CheckTls();
+            return n;
+        }
+        if (code == 101)
+        {
+            // Plain connections can be taken over from curl, TLS ones can not.
+            pthis->CheckTls();
+            if (pthis->m_transport != TransportCurl && !pthis->m_tls)
+                pthis->m_detached = true;
+            pthis->SetState(Connected);
+            pthis->StartConnectionTimers();
+            pthis->OnConnect(Success);
+        }
+        else
+        {
+            pthis->SetState(Disconnected);
+            pthis->OnConnect(Reject);
+        }
+    }
+    return n;
+}
+
+size_t WebSocketClientImplCurl::OnMessageReceived(char * ptr, size_t size, size_t nmemb, void * userdata)
+{
+    WebSocketClientImplCurl *pthis = (WebSocketClientImplCurl *)userdata;
+    size_t datalen = size * nmemb;
+    pthis->OnInbound(ptr, datalen);
+    if (pthis->m_detached)
+        return 0;   // stop the transfer, the client reads the socket from now on
+    if (pthis->OverInboundBudget())
+    {
+        pthis->WaitInboundBudget();     // curl does not read the socket meanwhile
+        if (pthis->m_abort)
+            return 0;
+    }
+    return datalen;
+}
+
+void WebSocketClientImplCurl::OnInbound(const char* data, size_t len)
+{
+    WS_TRACE_SCOPE(chunk, len);
+    m_stats.bytesReceived += len;
+    if (m_receiveTimeout)
+        m_lastInbound.store(TimerService::Now(), std::memory_order_relaxed);
+    if (m_capture)
+        CaptureInbound(data, len);
+    m_inboundFrames = 0;
+    m_inboundPayload = 0;
+    {
+        WS_TRACE_SCOPE(parse, len);
+        m_stats.framesReceived += ParseInbound(data, len);
+    }
+    if (m_maxInboundBytes || m_maxInboundFrames)
+    {
+        m_heldBytes += (int64_t)m_inboundPayload;
+        m_heldFrames += (int64_t)m_inboundFrames;
+    }
+}
+
+void WebSocketClientImplCurl::SetInboundBudget(uint64_t maxBytes, uint64_t maxFrames)
+{
+    m_maxInboundBytes = maxBytes;
+    m_maxInboundFrames = maxFrames;
+}
+
+void WebSocketClientImplCurl::ReleaseInbound(uint64_t bytes)
+{
+    m_heldBytes -= (int64_t)bytes;
+    --m_heldFrames;
+    if (m_inboundPaused && BelowInboundWatermark())
+    {
+        std::lock_guard<std::mutex> lock(m_inboundMutex);
+        m_inboundCond.notify_all();
+    }
+}
+
+bool WebSocketClientImplCurl::OverInboundBudget()
+{
+    if (m_inboundClosing)
+        return false;
+    return (m_maxInboundBytes && m_heldBytes > (int64_t)m_maxInboundBytes) ||
+           (m_maxInboundFrames && m_heldFrames > (int64_t)m_maxInboundFrames);
+}
+
+bool WebSocketClientImplCurl::BelowInboundWatermark()
+{
+    return m_inboundClosing || m_abort ||
+           ((!m_maxInboundBytes || m_heldBytes <= (int64_t)(m_maxInboundBytes / 2)) &&
+            (!m_maxInboundFrames || m_heldFrames <= (int64_t)(m_maxInboundFrames / 2)));
+}
+
+// Wake up a receive loop paused by WaitInboundBudget(), to see m_abort.
+void WebSocketClientImplCurl::WakeInbound()
+{
+    std::lock_guard<std::mutex> lock(m_inboundMutex);
+    m_inboundCond.notify_all();
+}
+
+// Stop reading until the application released enough of what it holds, or the connection is given up.
+void WebSocketClientImplCurl::WaitInboundBudget()
+{
+    WS_TRACE_SCOPE(inbound_pause, m_heldBytes);
+    std::unique_lock<std::mutex> lock(m_inboundMutex);
+    ++m_stats.inboundPauses;
+    m_inboundPaused = true;
+    m_inboundCond.wait(lock, [this] { return BelowInboundWatermark(); });
+    m_inboundPaused = false;
+}
+
+size_t WebSocketClientImplCurl::ParseInbound(const char* data, size_t datalen)
+{
+    return m_parser.Parse(data, datalen, [this](Message msg, bool fin) {
+        CountInbound(msg.len);
+        StampInbound(msg);
+        PublishInbound(msg, fin);
+        WS_TRACE_SCOPE(dispatch, msg.len);
+        OnRecv(msg, fin);
+    });
+}
+
+void WebSocketClientImplCurl::DispatchInbound(Message msg, bool fin)
+{
+    CountInbound(msg.len);
+    StampInbound(msg);
+    PublishInbound(msg, fin);
+    WS_TRACE_SCOPE(dispatch, msg.len);
+    OnRecv(msg, fin);
+}
+
+void WebSocketClientImplCurl::ResetInbound()
+{
+    m_parser.Reset();
+}
+
+void WebSocketClientImplCurl::CompactInbound()
+{
+    m_parser.Compact();
+}
+
+bool WebSocketClientImplCurl::SetCaptureFile(const char* path)
+{
+    if (m_capture)
+    {
+        fclose(m_capture);
+        m_capture = NULL;
+    }
+    if (!path)
+        return true;
+
+    m_capture = fopen(path, "wb");
+    if (!m_capture)
+        return false;
+    fwrite(CAPTURE_MAGIC, 1, sizeof(CAPTURE_MAGIC) - 1, m_capture);
+    return true;
+}
+
+// Append one capture record: the chunk size in network byte order and the raw bytes.
+void WebSocketClientImplCurl::CaptureInbound(const char* data, size_t len)
+{
+    uint32_t size = net_to_host((uint32_t)len);
+    fwrite(&size, sizeof(size), 1, m_capture);
+    fwrite(data, 1, len, m_capture);
+}
+
+void WebSocketClientImplCurl::RecvProc(void * userdata)
+{
+    WebSocketClientImplCurl *pthis = (WebSocketClientImplCurl *)userdata;
+
+    CURLcode ret = curl_easy_perform(pthis->m_curl);
+}
+
+void WebSocketClientImplCurl::ConnProc(WebSocketClientImplCurl* pthis)
+{
+    // Counted by Connect(), the destructor waits until the thread leaves.
+    struct ThreadCount
+    {
+        ~ThreadCount() { --client->m_connThreads; }
+        WebSocketClientImplCurl* client;
+    } count = { pthis };
+    if (pthis->GetState() != Disconnected)
+        return;
+    pthis->SetState(Connecting);
+    WS_TRACE_INSTANT(connect, 0);
+    pthis->m_timedOut = false;
+    if (pthis->m_handshakeTimeout)
+    {
+        TimerService& timers = TimerService::Instance();
+        std::lock_guard<std::mutex> lock(timers.mutex);
+        timers.Schedule(&pthis->m_handshakeTimer, pthis->m_handshakeTimeout);
+    }
+#ifdef __linux__
+    if (pthis->m_busyPoll && pthis->m_busyPollCpu >= 0)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(pthis->m_busyPollCpu, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+#endif
+    CURLcode ret = pthis->m_endpoints.empty() ? curl_easy_perform(pthis->m_curl) : pthis->RaceConnect();
+    if (pthis->m_transport == TransportCurlWebSocket && ret == CURLE_OK && !pthis->m_timedOut && !pthis->m_abort)
+    {
+        if (pthis->GetResponseCode() != 101)
+        {
+            pthis->StopTimers();
+            pthis->SetState(Disconnected);
+            pthis->OnConnect(Reject);
+            return;
+        }
+        // curl upgraded the connection and returned, the frames go through its WebSocket API now.
+        pthis->m_wsContinued = false;
+        pthis->m_wsFrame.clear();
+        pthis->SetState(Connected);
+        pthis->StartConnectionTimers();
+        pthis->OnConnect(Success);
+        pthis->RecvLoopCurlWs();
+        pthis->StopTimers();
+        pthis->SetState(Disconnected);
+        pthis->OnDisconnect();
+        return;
+    }
+    if (pthis->m_detached)
+    {
+        // curl stopped after the handshake and left the socket open for us.
+        pthis->RecvLoop();
+        pthis->StopTimers();
+        close_socket(pthis->m_sockfd);
+        pthis->m_detached = false;
+        pthis->SetState(Disconnected);
+        pthis->OnDisconnect();
+        return;
+    }
+    pthis->StopTimers();
+    bool established = pthis->GetState() == Connected;
+    pthis->SetState(Disconnected);
+    if (established)
+        pthis->OnDisconnect();
+    if (pthis->m_timedOut)
+    {
+        pthis->OnConnect(Timeout);
+    }
+    else if (ret == CURLE_OK || pthis->m_abort)
+    {
+    }
+    else if (ret == CURLE_COULDNT_CONNECT || ret == CURLE_OPERATION_TIMEDOUT)
+    {
+        pthis->OnConnect(Timeout);
+    }
+    else
+    {
+        pthis->OnConnect(Reject);
+    }
+}
+
+// One handshake of a race, the private data of its easy handle.
+struct WebSocketClientImplCurl::RaceAttempt
+{
+    WebSocketClientImplCurl* client;
+    size_t index;       // in m_endpoints and m_attempts
+    CURL* handle;
+    curl_socket_t sockfd;
+    std::chrono::steady_clock::time_point start;
+    bool done;          // finished, or removed from the race
+};
+
+// Race the handshakes with m_endpoints, then run the winning transfer as curl_easy_perform() would.
+CURLcode WebSocketClientImplCurl::RaceConnect()
+{
+    typedef std::chrono::steady_clock Clock;
+    CURLM* multi = curl_multi_init();
+    if (!multi)
+        return CURLE_OUT_OF_MEMORY;
+    SetTimerMulti(multi);
+
+    size_t count = m_endpoints.size();
+    std::vector<RaceAttempt> attempts(count);
+    {
+        std::lock_guard<std::mutex> lock(m_attemptsMutex);
+        m_attempts.assign(count, EndpointAttempt());
+        for (size_t i = 0; i < count; ++i)
+        {
+            m_attempts[i].url = m_endpoints[i];
+            m_attempts[i].result = AttemptNotStarted;
+            m_attempts[i].startUs = -1;
+            m_attempts[i].elapsedUs = -1;
+            m_attempts[i].connectUs = -1;
         }
+    }
+    m_raceWinner = NULL;
+    CURL* configured = m_curl;
+    Clock::time_point raceStart = Clock::now();
+    Clock::time_point nextStart = raceStart;
+    size_t started = 0;
+    int running = 0;
+    CURLcode result = CURLE_COULDNT_CONNECT;
+    bool finished = false;
 
-#define MOVE_FORWARD(size) \
-        tmp += size; \
-        remaining -= size;
+    while (!finished)
+    {
+        // Start the next handshake when it is due, or at once if all the others have failed.
+        Clock::time_point now = Clock::now();
+        if (started < count && !m_raceWinner && (now >= nextStart || running == 0))
+        {
+            RaceAttempt& attempt = attempts[started];
+            attempt.client = this;
+            attempt.index = started;
+            attempt.sockfd = CURL_SOCKET_BAD;
+            attempt.start = now;
+            attempt.done = false;
+            attempt.handle = curl_easy_duphandle(configured);
+            if (attempt.handle)
+            {
+                CURL* handle = attempt.handle;
+                SetUrl(handle, m_endpoints[started].c_str());
+                curl_easy_setopt(handle, CURLOPT_PRIVATE, &attempt);
+                curl_easy_setopt(handle, CURLOPT_OPENSOCKETFUNCTION, RaceOpenSocket);
+                curl_easy_setopt(handle, CURLOPT_OPENSOCKETDATA, &attempt);
+                curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION, RaceHeader);
+                curl_easy_setopt(handle, CURLOPT_HEADERDATA, &attempt);
+                curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, RaceWrite);
+                curl_easy_setopt(handle, CURLOPT_WRITEDATA, &attempt);
+                curl_easy_setopt(handle, CURLOPT_CLOSESOCKETFUNCTION, RaceCloseSocket);
+                curl_easy_setopt(handle, CURLOPT_CLOSESOCKETDATA, &attempt);
+                curl_easy_setopt(handle, CURLOPT_XFERINFOFUNCTION, RaceProgress);
+                curl_easy_setopt(handle, CURLOPT_XFERINFODATA, &attempt);
+                curl_multi_add_handle(multi, handle);
+                ++running;
+            }
+            else
+            {
+                attempt.done = true;
+            }
+            {
+                std::lock_guard<std::mutex> lock(m_attemptsMutex);
+                m_attempts[started].startUs =
+                    std::chrono::duration_cast<std::chrono::microseconds>(now - raceStart).count();
+                if (!attempt.handle)
+                    m_attempts[started].result = AttemptFailed;
+            }
+            ++started;
+            nextStart = now + std::chrono::milliseconds(m_staggerMs);
+            continue;
+        }
 
-#define PARSE_WS_HEADER(endian) \
-        payloadlen = header.endian.payloadlen; \
- \
-        if (header.endian.payloadlen == 126) \
-        { \
-            CHECK_REMAINING(2) \
-            u_short *len = (u_short *)tmp; \
-            payloadlen = net_to_host(*len); /* net order to host order */\
-            MOVE_FORWARD(2) \
-        } \
-        else if (header.endian.payloadlen == 127) \
-        { \
-            CHECK_REMAINING(8) \
-            uint64_t *len = (uint64_t *)tmp; \
-            payloadlen = net_to_host(*len); /* net order to host order */\
-            MOVE_FORWARD(8) \
+        int active = 0;
+        curl_multi_perform(multi, &active);
+        CURLMsg* msg;
+        int queued;
+        while ((msg = curl_multi_info_read(multi, &queued)) != NULL)
+        {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+            RaceAttempt* attempt = NULL;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**)&attempt);
+            CURLcode code = msg->data.result;
+            if (attempt == m_raceWinner)
+            {
+                result = code;
+                finished = true;
+                break;
+            }
+            if (!attempt->done)
+            {
+                // Refused, timed out, or answered without upgrading.
+                result = code != CURLE_OK ? code : CURLE_HTTP_RETURNED_ERROR;
+                FinishAttempt(attempt, AttemptFailed);
+            }
+            curl_multi_remove_handle(multi, attempt->handle);
+            curl_easy_cleanup(attempt->handle);
+            attempt->handle = NULL;
+            --running;
         }
+        if (finished)
+            break;
 
-#define UNMASK_PAYLOAD(endian) \
-        if (header.endian.masked) \
-        { \
-            /* Get mask key */\
-            CHECK_REMAINING(4) \
-            mask mask_key; \
-            memcpy(&mask_key, tmp, 4); \
-            MOVE_FORWARD(4) \
- \
-            /* Unmask data */\
-            CHECK_REMAINING(payloadlen) \
-            WsMask(tmp, payloadlen, mask_key.chararr); \
- \
-        } \
-        frame_type = (FrameType)header.endian.opcode; \
-        fin = (bool)header.endian.fin;
+        if (m_raceWinner)
+        {
+            // The others were cancelled by the winner, close them.
+            for (size_t i = 0; i < started; ++i)
+            {
+                if (&attempts[i] != m_raceWinner && attempts[i].handle)
+                {
+                    curl_multi_remove_handle(multi, attempts[i].handle);
+                    curl_easy_cleanup(attempts[i].handle);
+                    attempts[i].handle = NULL;
+                    --running;
+                }
+            }
+        }
+        else if (running == 0 && started == count)
+        {
+            break;  // every attempt failed
+        }
 
+        int wait = 1000;
+        if (started < count && !m_raceWinner && running == 0)
+            continue;   // all failed, start the next one now
+        if (started < count && !m_raceWinner)
+        {
+            int64_t due = std::chrono::duration_cast<std::chrono::milliseconds>(nextStart - Clock::now()).count();
+            wait = (int)std::max<int64_t>(0, std::min<int64_t>(due, wait));
+        }
+        curl_multi_poll(multi, NULL, 0, wait, NULL);
+    }
 
-size_t WebSocketClientImplCurl::OnMessageReceived(char * ptr, size_t size, size_t nmemb, void * userdata)
+    if (m_raceWinner)
+    {
+        curl_multi_remove_handle(multi, m_raceWinner->handle);
+        curl_easy_cleanup(m_raceWinner->handle);    // the socket stays open if it was handed over
+        m_curl = configured;
+        m_raceWinner = NULL;
+    }
+    SetTimerMulti(NULL);
+    curl_multi_cleanup(multi);
+    return result;
+}
+
+// Record the outcome of an attempt.
+void WebSocketClientImplCurl::FinishAttempt(RaceAttempt* attempt, AttemptResult result)
 {
-    WebSocketClientImplCurl *pthis = (WebSocketClientImplCurl *)userdata;
-    size_t datalen = size * nmemb;
-    pthis->buffer.append(ptr, datalen);
+    attempt->done = true;
+    curl_off_t connect = 0;
+    curl_easy_getinfo(attempt->handle, CURLINFO_APPCONNECT_TIME_T, &connect);
+    if (!connect)
+        curl_easy_getinfo(attempt->handle, CURLINFO_CONNECT_TIME_T, &connect);
+    std::lock_guard<std::mutex> lock(m_attemptsMutex);
+    EndpointAttempt& entry = m_attempts[attempt->index];
+    entry.result = result;
+    entry.elapsedUs = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - attempt->start).count();
+    entry.connectUs = connect ? (int64_t)connect : -1;
+}
+
+curl_socket_t WebSocketClientImplCurl::RaceOpenSocket(void* clientp, curlsocktype purpose, curl_sockaddr* address)
+{
+    RaceAttempt* attempt = (RaceAttempt*)clientp;
+    attempt->sockfd = attempt->client->OpenSocket(address);
+    return attempt->sockfd;
+}
+
+size_t WebSocketClientImplCurl::RaceHeader(char* buffer, size_t size, size_t nitems, void* userdata)
+{
+    RaceAttempt* attempt = (RaceAttempt*)userdata;
+    WebSocketClientImplCurl* pthis = attempt->client;
+    if (pthis->m_raceWinner == attempt)
+        return OnHeaderReceived(buffer, size, nitems, pthis);
+    if (pthis->m_raceWinner)
+        return 0;   // lost, stop this transfer
+    size_t n = size * nitems;
+    long code = 0;
+    if (n >= 4 && memcmp(buffer, "HTTP", 4) == 0 &&
+        curl_easy_getinfo(attempt->handle, CURLINFO_RESPONSE_CODE, &code) == CURLE_OK && code == 101)
+    {
+        // First to upgrade, this attempt becomes the connection.
+        pthis->m_raceWinner = attempt;
+        pthis->m_sockfd = attempt->sockfd;
+        pthis->SetTimerSocket(attempt->sockfd);
+        pthis->m_curl = attempt->handle;
+        pthis->FinishAttempt(attempt, AttemptWon);
+        RaceAttempt* attempts = attempt - attempt->index;  // all attempts of the race are in one array
+        for (size_t i = 0; i < pthis->m_endpoints.size(); ++i)
+        {
+            if (attempts[i].handle && !attempts[i].done)
+                pthis->FinishAttempt(&attempts[i], AttemptCancelled);
+        }
+        return OnHeaderReceived(buffer, size, nitems, pthis);
+    }
+    return n;
+}
+
+size_t WebSocketClientImplCurl::RaceWrite(char* ptr, size_t size, size_t nmemb, void* userdata)
+{
+    RaceAttempt* attempt = (RaceAttempt*)userdata;
+    if (attempt->client->m_raceWinner == attempt)
+        return OnMessageReceived(ptr, size, nmemb, attempt->client);
+    return size * nmemb;    // body of a refused upgrade
+}
+
+int WebSocketClientImplCurl::RaceCloseSocket(void* clientp, curl_socket_t item)
+{
+    RaceAttempt* attempt = (RaceAttempt*)clientp;
+    if (attempt->client->m_raceWinner == attempt)
+        return CloseSocketCallback(attempt->client, item);
+    return close_socket(item);
+}
+
+int WebSocketClientImplCurl::RaceProgress(void* clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
+{
+    RaceAttempt* attempt = (RaceAttempt*)clientp;
+    WebSocketClientImplCurl* pthis = attempt->client;
+    if (pthis->m_raceWinner == attempt)
+        return ProgressCallback(pthis, dltotal, dlnow, ultotal, ulnow);
+    return pthis->m_raceWinner || pthis->m_abort ? 1 : 0;
+}
 
-    char * tmp = &pthis->buffer[0];
-    size_t remaining = pthis->buffer.size();
+int WebSocketClientImplCurl::CloseSocketCallback(void * clientp, curl_socket_t item)
+{
+    WebSocketClientImplCurl *pthis = (WebSocketClientImplCurl *)clientp;
+    if (pthis->m_detached && item == pthis->m_sockfd)
+        return 0;   // handed over, closed by ConnProc()
+    pthis->ForgetTimerSocket(item);     // no timer may shut the descriptor down once it can be reused
+    return close_socket(item);
+}
+
+int WebSocketClientImplCurl::ProgressCallback(void * clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
+{
+    WebSocketClientImplCurl *pthis = (WebSocketClientImplCurl *)clientp;
+    return pthis->m_detached || pthis->m_abort ? 1 : 0;   // abort the transfer once the socket is handed over
+}
 
-    while (remaining)
+// Receive on the handed over socket until the connection is closed.
+void WebSocketClientImplCurl::RecvLoop()
+{
+    bool uring = !m_busyPoll && (m_transport == TransportIoUring || m_transport == TransportIoUringSqPoll);
+    int timeout = m_idleTimeout ? (int)m_idleTimeout : -1;
+    std::chrono::steady_clock::time_point idleAt;   // busy polling stops spinning then
+    if (m_busyPoll && m_idleTimeout)
+        idleAt = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_idleTimeout);
+    char* buff = NULL;
+    pollfd pfd;
+    pfd.fd = m_sockfd;
+    pfd.events = POLLIN;
+    for (;;)
     {
-        char *start = tmp;
-        size_t len = remaining;
+#ifdef WEBSOCKET_CLIENT_IO_URING
+        if (uring)
+        {
+            int ret = RecvLoopIoUring();
+            if (ret == 0)
+                break;
+            if (ret > 0)
+            {
+                Hibernate();
+                poll(&pfd, 1, -1);
+                ++m_stats.recvCalls;
+                continue;
+            }
+            uring = false;  // not available, fall back to recv()
+        }
+#endif
+        if (OverInboundBudget())
+        {
+            WaitInboundBudget();
+            if (m_abort)
+                break;
+        }
+        if (!buff && !(buff = AcquireRecvBuffer()))
+            break;
+        int64_t n = m_timestamps ? RecvStamped(buff, recvBufferSize) : recv(m_sockfd, buff, recvBufferSize, 0);
+        ++m_stats.recvCalls;
+        if (n > 0)
+        {
+            OnInbound(buff, (size_t)n);
+            if (m_busyPoll && m_idleTimeout)
+                idleAt = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_idleTimeout);
+            continue;
+        }
+        if (n == 0 || !SocketWouldBlock())
+            break;
+        if (m_busyPoll)
+        {
+            if (!m_idleTimeout || std::chrono::steady_clock::now() < idleAt)
+            {
+                CPU_RELAX();
+                continue;
+            }
+            // Quiet for the idle timeout, sleep until data arrives.
+            ReleaseRecvBuffer(buff);
+            buff = NULL;
+            Hibernate();
+            poll(&pfd, 1, -1);
+            ++m_stats.recvCalls;
+            idleAt = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_idleTimeout);
+            continue;
+        }
+        ++m_stats.recvCalls;
+        if (poll(&pfd, 1, timeout) == 0)
+        {
+            // Quiet for the idle timeout, give the memory back until data arrives.
+            ReleaseRecvBuffer(buff);
+            buff = NULL;
+            Hibernate();
+            poll(&pfd, 1, -1);
+            ++m_stats.recvCalls;
+        }
+    }
+    if (buff)
+        ReleaseRecvBuffer(buff);
+}
+
+#ifdef WEBSOCKET_CLIENT_CURL_WS
+// curl 8 made the frame information const, take it either way.
+template <class Frame>
+static CURLcode CurlWsRecv(CURLcode (*recvFrame)(CURL*, void*, size_t, size_t*, Frame**), CURL* curl, char* buffer,
+                           size_t len, size_t* nread, const curl_ws_frame** meta)
+{
+    Frame* frame = NULL;
+    CURLcode res = recvFrame(curl, buffer, len, nread, &frame);
+    *meta = frame;
+    return res;
+}
+
+static FrameType CurlWsType(int flags)
+{
+    if (flags & CURLWS_CLOSE)
+        return Close;
+    if (flags & CURLWS_PING)
+        return Ping;
+    if (flags & CURLWS_PONG)
+        return Pong;
+    return (flags & CURLWS_TEXT) ? Text : Binary;
+}
+#endif
 
-        CHECK_REMAINING(2)
-        WsHeader header;
-        memcpy(&header, tmp, 2);
-        MOVE_FORWARD(2)
+// Receive with curl_ws_recv() until the connection ends, for TransportCurlWebSocket.
+void WebSocketClientImplCurl::RecvLoopCurlWs()
+{
+#ifdef WEBSOCKET_CLIENT_CURL_WS
+    char* buff = AcquireRecvBuffer();
+    if (!buff)
+        return;
+    pollfd pfd;
+    pfd.fd = m_sockfd;
+    pfd.events = POLLIN;
+    while (!m_abort)
+    {
+        if (OverInboundBudget())
+            WaitInboundBudget();
+        size_t nread = 0;
+        const curl_ws_frame* meta = NULL;
+        CURLcode res;
+        {
+            // The easy handle is not thread-safe, the send functions use it under the same lock.
+            std::lock_guard<std::mutex> lock(m_sendMutex);
+            res = CurlWsRecv(curl_ws_recv, m_curl, buff, recvBufferSize, &nread, &meta);
+        }
+        ++m_stats.recvCalls;
+        if (res == CURLE_AGAIN)
+        {
+            poll(&pfd, 1, -1);
+            ++m_stats.recvCalls;
+            continue;
+        }
+        if (res != CURLE_OK || !meta)
+            break;
+        m_stats.bytesReceived += nread;
+        if (m_receiveTimeout)
+            m_lastInbound.store(TimerService::Now(), std::memory_order_relaxed);
 
-        uint64_t payloadlen = 0;
-        FrameType frame_type = Text;
+        // A frame larger than the buffer comes in pieces, only those are copied.
+        const char* data = buff;
+        size_t len = nread;
+        if (meta->bytesleft > 0 || !m_wsFrame.empty())
+        {
+            m_wsFrame.append(buff, nread);
+            if (meta->bytesleft > 0)
+                continue;
+            data = m_wsFrame.data();
+            len = m_wsFrame.size();
+        }
+        FrameType type = CurlWsType(meta->flags);
         bool fin = true;
+        if (type == Text || type == Binary)
+        {
+            fin = !(meta->flags & CURLWS_CONT);
+            if (m_wsContinued)
+                type = Continuation;
+            m_wsContinued = !fin;
+        }
+        ++m_stats.framesReceived;
+        m_inboundFrames = 0;
+        m_inboundPayload = 0;
+        DispatchInbound(Message(type, data, len), fin);
+        if (m_maxInboundBytes || m_maxInboundFrames)
+        {
+            m_heldBytes += (int64_t)m_inboundPayload;
+            m_heldFrames += (int64_t)m_inboundFrames;
+        }
+        m_wsFrame.clear();
+    }
+    ReleaseRecvBuffer(buff);
+    // curl keeps the connection until the next transfer of the handle, let the server see it end now.
+#ifdef _WIN32
+    shutdown(m_sockfd, SD_BOTH);
+#else
+    shutdown(m_sockfd, SHUT_RDWR);
+#endif
+#endif
+}
+
+// recv() which also stores the kernel receive time of the data into m_kernelTime.
+int64_t WebSocketClientImplCurl::RecvStamped(char* buff, size_t len)
+{
+#ifdef __linux__
+    char control[timestampControlSize];
+    iovec iov;
+    iov.iov_base = buff;
+    iov.iov_len = len;
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    int64_t n = recvmsg(m_sockfd, &msg, 0);
+    if (n > 0)
+        m_kernelTime = ReadTimestamp(&msg);
+    return n;
+#else
+    return recv(m_sockfd, buff, len, 0);
+#endif
+}
+
+// Drop the memory an idle connection does not need, it is allocated again when data arrives.
+void WebSocketClientImplCurl::Hibernate()
+{
+    WS_TRACE_INSTANT(hibernate, 0);
+    CompactInbound();
+    std::lock_guard<std::mutex> lock(m_sendMutex);
+    if (m_control.empty())
+        std::string().swap(m_control);
+    if (m_closeFrame.empty())
+        std::string().swap(m_closeFrame);
+    ++m_stats.hibernations;
+}
+
+#ifdef WEBSOCKET_CLIENT_IO_URING
+// io_uring version of RecvLoop(), return -1 if the rings can not be set up, 0 when the connection is closed,
+// or 1 after the idle timeout, with the rings released.
+int WebSocketClientImplCurl::RecvLoopIoUring()
+{
+    // 16 buffers of 16 KB, the kernel picks one for each chunk received.
+    IoUringRing ring;
+    if (!ring.Init(4, false) || !ring.SetupBufferRing(0, 16, 16 * 1024))
+        return -1;
+
+    IoUringRing* sendRing = new IoUringRing();
+    if (!sendRing->Init(4, m_transport == TransportIoUringSqPoll))
+    {
+        delete sendRing;
+        sendRing = NULL;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_sendMutex);
+        m_sendRing = sendRing;
+    }
 
-        bool endian = HostIsBigEndian();
-        if (endian)
+    // user_data of the requests
+    enum { recvRequest = 0, timeoutRequest = 1, cancelRequest = 2 };
+    __kernel_timespec idle;
+    idle.tv_sec = m_idleTimeout / 1000;
+    idle.tv_nsec = (long long)(m_idleTimeout % 1000) * 1000000;
+
+    // With timestamps the chunks are received by recvmsg, each buffer then starts with an io_uring_recvmsg_out
+    // header followed by the control messages.
+    char control[timestampControlSize];
+    msghdr stamped;
+    memset(&stamped, 0, sizeof(stamped));
+    stamped.msg_controllen = sizeof(control);
+
+    bool armed = false;
+    bool timing = false;
+    bool closed = false;
+    bool quiet = false;
+    bool pausing = false;
+    while (!closed && !(quiet && !armed))
+    {
+        if (pausing && !armed)
         {
-            PARSE_WS_HEADER(big)
+            WaitInboundBudget();
+            pausing = false;
+            if (m_abort)
+            {
+                closed = true;
+                break;
+            }
         }
-        else
+        if (!armed && !quiet)
         {
-            PARSE_WS_HEADER(little)
+            // One request keeps receiving until it runs out of buffers or the connection is closed.
+            io_uring_sqe* sqe = ring.GetSqe();
+            sqe->opcode = IORING_OP_RECV;
+            if (m_timestamps)
+            {
+                sqe->opcode = IORING_OP_RECVMSG;
+                sqe->addr = (uint64_t)(uintptr_t)&stamped;
+            }
+            sqe->fd = m_sockfd;
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = 0;
+            sqe->user_data = recvRequest;
+            armed = true;
         }
+        if (m_idleTimeout && !timing && !quiet)
+        {
+            // Expires unless another completion arrives first.
+            io_uring_sqe* sqe = ring.GetSqe();
+            sqe->opcode = IORING_OP_TIMEOUT;
+            sqe->addr = (uint64_t)(uintptr_t)&idle;
+            sqe->len = 1;
+            sqe->off = 1;
+            sqe->user_data = timeoutRequest;
+            timing = true;
+        }
+        uint64_t before = ring.EnterCalls();
+        if (!ring.Submit(1))
+            break;
+        m_stats.recvCalls += ring.EnterCalls() - before;
 
-        if (endian)
+        io_uring_cqe* cqe;
+        while ((cqe = ring.PeekCqe()) != NULL)
         {
-            UNMASK_PAYLOAD(big)
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            uint64_t request = cqe->user_data;
+            ring.SeenCqe();
+            if (request == cancelRequest)
+                continue;
+            if (request == timeoutRequest)
+            {
+                timing = false;
+                if (res == -ETIME && !quiet)
+                {
+                    // Quiet for the idle timeout, stop receiving and release the rings.
+                    quiet = true;
+                    io_uring_sqe* sqe = ring.GetSqe();
+                    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                    sqe->addr = recvRequest;
+                    sqe->user_data = cancelRequest;
+                }
+                continue;
+            }
+            if (!(flags & IORING_CQE_F_MORE))
+                armed = false;
+            if (res > 0 && m_timestamps)
+            {
+                unsigned short bid = (unsigned short)(flags >> IORING_CQE_BUFFER_SHIFT);
+                io_uring_recvmsg_out* out = (io_uring_recvmsg_out*)ring.Buffer(bid);
+                msghdr received;
+                memset(&received, 0, sizeof(received));
+                received.msg_control = (char*)(out + 1) + stamped.msg_namelen;
+                received.msg_controllen = out->controllen;
+                m_kernelTime = ReadTimestamp(&received);
+                uint32_t payloadlen = out->payloadlen;
+                if (payloadlen)
+                    OnInbound((char*)received.msg_control + stamped.msg_controllen, payloadlen);
+                ring.RecycleBuffer(bid);
+                if (!payloadlen)
+                {
+                    closed = true;  // end of stream
+                    break;
+                }
+            }
+            else if (res > 0)
+            {
+                unsigned short bid = (unsigned short)(flags >> IORING_CQE_BUFFER_SHIFT);
+                OnInbound(ring.Buffer(bid), (size_t)res);
+                ring.RecycleBuffer(bid);
+            }
+            else if (res != -ENOBUFS && !((quiet || pausing) && res == -ECANCELED))
+            {
+                closed = true;  // end of stream or error
+                break;
+            }
         }
-        else
+        if (armed && !pausing && !quiet && OverInboundBudget())
         {
-            UNMASK_PAYLOAD(little)
+            // Stop receiving until the application caught up.
+            pausing = true;
+            io_uring_sqe* sqe = ring.GetSqe();
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = recvRequest;
+            sqe->user_data = cancelRequest;
         }
+    }
 
-        CHECK_REMAINING(payloadlen)
-        Message msg(frame_type, tmp, payloadlen);
-        // TODO: parse the reserved bits
-        pthis->OnRecv(msg, fin);
-        MOVE_FORWARD(payloadlen)
+    {
+        std::lock_guard<std::mutex> lock(m_sendMutex);
+        m_sendRing = NULL;
     }
-    pthis->buffer.clear();
-    return datalen;
+    delete sendRing;
+    return closed || !quiet ? 0 : 1;
 }
+#endif
 
-void WebSocketClientImplCurl::RecvProc(void * userdata)
+void WebSocketClientImplCurl::SetTlsSessionSharing(bool enable)
 {
-    WebSocketClientImplCurl *pthis = (WebSocketClientImplCurl *)userdata;
+    std::call_once(sharedSessionsOnce, InitSharedSessions);
+    curl_easy_setopt(m_curl, CURLOPT_SHARE, enable ? sharedSessions : NULL);
+}
 
-    CURLcode ret = curl_easy_perform(pthis->m_curl);
+bool WebSocketClientImplCurl::SetKernelTls(bool enable)
+{
+#ifdef WEBSOCKET_CLIENT_OPENSSL
+    CURLcode ret = curl_easy_setopt(m_curl, CURLOPT_SSL_CTX_FUNCTION, enable ? SslCtxCallback : NULL);
+    return ret == CURLE_OK;
+#else
+    return !enable;
+#endif
 }
 
-void WebSocketClientImplCurl::ConnProc(WebSocketClientImplCurl* pthis)
+bool WebSocketClientImplCurl::GetKernelTlsState(bool* send, bool* recv)
 {
-    if (pthis->GetState() != Disconnected)
+    *send = m_ktlsSend;
+    *recv = m_ktlsRecv;
+#ifdef WEBSOCKET_CLIENT_OPENSSL
+    return m_tls;
+#else
+    return false;
+#endif
+}
+
+// Find out whether the connection runs over TLS, and if the kernel took the record layer over.
+void WebSocketClientImplCurl::CheckTls()
+{
+    char* scheme = NULL;
+    curl_easy_getinfo(m_curl, CURLINFO_SCHEME, &scheme);
+    m_tls = scheme && (curl_strequal(scheme, "https") || curl_strequal(scheme, "wss"));   // ws with TransportCurlWebSocket
+    m_ktlsSend = false;
+    m_ktlsRecv = false;
+#ifdef WEBSOCKET_CLIENT_OPENSSL
+    struct curl_tlssessioninfo* info = NULL;
+    if (m_tls && curl_easy_getinfo(m_curl, CURLINFO_TLS_SSL_PTR, &info) == CURLE_OK &&
+        info && info->backend == CURLSSLBACKEND_OPENSSL && info->internals)
+    {
+        SSL* ssl = (SSL*)info->internals;
+        m_ktlsSend = BIO_get_ktls_send(SSL_get_wbio(ssl)) > 0;
+        m_ktlsRecv = BIO_get_ktls_recv(SSL_get_rbio(ssl)) > 0;
+    }
+#endif
+}
+
+bool WebSocketClientImplCurl::SetReceiveTimestamps(bool enable)
+{
+#ifdef __linux__
+    m_timestamps = enable;
+    return true;
+#else
+    return !enable;
+#endif
+}
+
+bool WebSocketClientImplCurl::SetFanOutRing(const char* path, uint64_t capacity)
+{
+    if (!path)
+    {
+        m_fanOut.Close();
+        return true;
+    }
+    return m_fanOut.Open(path, capacity);
+}
+
+bool WebSocketClientImplCurl::SetBusyPoll(bool enable, int cpu, unsigned socketBusyPollUs)
+{
+#ifdef __linux__
+    m_busyPoll = enable;
+    m_busyPollCpu = cpu;
+    m_socketBusyPoll = socketBusyPollUs;
+    return true;
+#else
+    return !enable;
+#endif
+}
+
+void WebSocketClientImplCurl::SetIdleTimeout(unsigned milliseconds)
+{
+    m_idleTimeout = milliseconds;
+}
+
+bool WebSocketClientImplCurl::SetTransport(Transport transport)
+{
+#ifndef WEBSOCKET_CLIENT_IO_URING
+    if (transport == TransportIoUring || transport == TransportIoUringSqPoll)
+        return false;
+#endif
+    if (transport == TransportCurlWebSocket)
+    {
+        // The API is declared by every recent curl, the protocol only there if libcurl was built with it.
+        bool supported = false;
+#ifdef WEBSOCKET_CLIENT_CURL_WS
+        const curl_version_info_data* info = curl_version_info(CURLVERSION_NOW);
+        for (const char* const* protocol = info->protocols; protocol && *protocol; ++protocol)
+            supported = supported || strcmp(*protocol, "ws") == 0;
+#endif
+        if (!supported)
+            return false;
+    }
+    m_transport = transport;
+    return true;
+}
+
+void WebSocketClientImplCurl::SetHandshakeTimeout(unsigned milliseconds)
+{
+    m_handshakeTimeout = milliseconds;
+}
+
+void WebSocketClientImplCurl::SetReceiveTimeout(unsigned milliseconds)
+{
+    m_receiveTimeout = milliseconds;
+}
+
+void WebSocketClientImplCurl::SetPingInterval(unsigned milliseconds)
+{
+    m_pingInterval = milliseconds;
+}
+
+void WebSocketClientImplCurl::SetCloseTimeout(unsigned milliseconds)
+{
+    m_closeTimeout = milliseconds;
+}
+
+void WebSocketClientImplCurl::OnTimer(TimerNode* node)
+{
+    ((WebSocketClientImplCurl*)node->opaque)->TimerExpired(node);
+}
+
+void WebSocketClientImplCurl::OnDeferred(void* opaque)
+{
+    ((WebSocketClientImplCurl*)opaque)->SendDeferred();
+}
+
+// Called on the timer thread, with the timer lock held.
+void WebSocketClientImplCurl::TimerExpired(TimerNode* timer)
+{
+    TimerService& timers = TimerService::Instance();
+    if (timer == &m_flushTimer || timer == &m_pingTimer)
+    {
+        // Sending waits for the send lock and writes the socket, which is left until the timer lock is released.
+        if (timer == &m_pingTimer)
+        {
+            m_pingDue = true;
+            timers.Schedule(&m_pingTimer, m_pingInterval);
+        }
+        timers.Defer(OnDeferred, this);
         return;
-    pthis->SetState(Connecting);
-    CURLcode ret = curl_easy_perform(pthis->m_curl);
-    pthis->SetState(Disconnected);
-    if (ret == CURLE_OK)
+    }
+    if (timer == &m_receiveTimer)
     {
+        // Inbound data does not move the timer, it is checked here instead.
+        uint64_t quiet = TimerService::Now() - m_lastInbound.load(std::memory_order_relaxed);
+        if (quiet < m_receiveTimeout)
+        {
+            timers.Schedule(&m_receiveTimer, (unsigned)(m_receiveTimeout - quiet));
+            return;
+        }
     }
-    else if (ret == CURLE_COULDNT_CONNECT || ret == CURLE_OPERATION_TIMEDOUT)
+    else if (timer == &m_handshakeTimer)
     {
-        pthis->OnConnect(Timeout);
+        if (GetState() != Connecting)
+            return;
+        m_timedOut = true;
     }
-    else
+
+    ++m_stats.timeouts;
+    Abort();
+}
+
+// Give the connection up: curl stops at its next progress check, which a race runs at once when woken up, the
+// socket wakes up whoever reads it, a receive loop paused for the inbound budget goes on. The caller holds the
+// timer lock.
+void WebSocketClientImplCurl::Abort()
+{
+    m_abort = true;
+    WakeInbound();
+    if (m_timerMulti)
+        curl_multi_wakeup(m_timerMulti);
+    if (m_timerSocket != CURL_SOCKET_BAD)
     {
-        pthis->OnConnect(Reject);
+#ifdef _WIN32
+        shutdown(m_timerSocket, SD_BOTH);
+#else
+        shutdown(m_timerSocket, SHUT_RDWR);
+#endif
+    }
+}
+
+// Send a due ping and the frames held by SetWriteCoalescing() which the application did not flush, on the timer
+// thread without the timer lock. Never waits for the send lock and never pulls stream data: both would let
+// one client hold up the timers of all.
+void WebSocketClientImplCurl::SendDeferred()
+{
+    unsigned rearm = 0;
+    {
+        std::unique_lock<std::mutex> lock(m_sendMutex, std::try_to_lock);
+        if (!lock.owns_lock())
+        {
+            rearm = 1;  // the thread sending takes a due ping along, in case it does not try again shortly
+        }
+        else if (GetState() == Connected)
+        {
+            SendPending(false);
+            if (m_batchLen && sendbufflen == sendoffset && !m_stream)
+                rearm = (m_coalesceDelay + 999) / 1000 + 1;  // held since the last write
+        }
+    }
+    if (rearm)
+    {
+        TimerService& timers = TimerService::Instance();
+        std::lock_guard<std::mutex> lock(timers.mutex);
+        if (!TimerWheel::Scheduled(&m_flushTimer))
+            timers.Schedule(&m_flushTimer, rearm);
+    }
+}
+
+// Publish the socket of the connection to the timers and the destructor.
+void WebSocketClientImplCurl::SetTimerSocket(curl_socket_t sockfd)
+{
+    std::lock_guard<std::mutex> lock(TimerService::Instance().mutex);
+    m_timerSocket = sockfd;
+}
+
+// Publish the multi handle of a race to the timers.
+void WebSocketClientImplCurl::SetTimerMulti(CURLM* multi)
+{
+    std::lock_guard<std::mutex> lock(TimerService::Instance().mutex);
+    m_timerMulti = multi;
+}
+
+void WebSocketClientImplCurl::ForgetTimerSocket(curl_socket_t sockfd)
+{
+    std::lock_guard<std::mutex> lock(TimerService::Instance().mutex);
+    if (m_timerSocket == sockfd)
+        m_timerSocket = CURL_SOCKET_BAD;
+}
+
+// The handshake completed: arm the timers of the established connection.
+void WebSocketClientImplCurl::StartConnectionTimers()
+{
+    if (!m_handshakeTimeout && !m_receiveTimeout && !m_pingInterval)
+        return;
+    TimerService& timers = TimerService::Instance();
+    std::lock_guard<std::mutex> lock(timers.mutex);
+    timers.Cancel(&m_handshakeTimer);
+    m_pingDue = false;
+    if (m_receiveTimeout)
+    {
+        m_lastInbound = TimerService::Now();
+        timers.Schedule(&m_receiveTimer, m_receiveTimeout);
     }
+    if (m_pingInterval)
+        timers.Schedule(&m_pingTimer, m_pingInterval);
 }
 
+// Disarm every timer and forget the socket, which is about to be closed.
+void WebSocketClientImplCurl::StopTimers()
+{
+    TimerService& timers = TimerService::Instance();
+    std::unique_lock<std::mutex> lock(timers.mutex);
+    timers.Forget(this, lock);  // first, deferred sending may arm the flush timer again
+    timers.Cancel(&m_handshakeTimer);
+    timers.Cancel(&m_receiveTimer);
+    timers.Cancel(&m_pingTimer);
+    timers.Cancel(&m_closeTimer);
+    timers.Cancel(&m_flushTimer);
+    m_timerSocket = CURL_SOCKET_BAD;
+}
+
+WebSocketClientImplCurl::Statistics WebSocketClientImplCurl::GetStatistics()
+{
+    Statistics stats;
+    stats.framesSent = m_stats.framesSent.Load();
+    stats.framesReceived = m_stats.framesReceived.Load();
+    stats.bytesSent = m_stats.bytesSent.Load();
+    stats.bytesReceived = m_stats.bytesReceived.Load();
+    stats.sendCalls = m_stats.sendCalls.Load();
+    stats.recvCalls = m_stats.recvCalls.Load();
+    stats.hibernations = m_stats.hibernations.Load();
+    stats.inboundPauses = m_stats.inboundPauses.Load();
+    stats.conflated = m_stats.conflated.Load();
+    stats.timeouts = m_stats.timeouts.Load();
+    stats.coalesced = m_stats.coalesced.Load();
+    return stats;
+}
 
 inline void WebSocketClientImplCurl::SetState(State newState)
 {
@@ -509,11 +3084,42 @@ inline void WebSocketClientImplCurl::SetState(State newState)
 
 void ws::WebSocketClientImplCurl::ClearSendBuff()
 {
+    if (m_sendFromSpool)
+    {
+        // Points into the spool, which keeps the frames.
+        m_sendFromSpool = false;
+        sendbuff = nullptr;
+        sendbufflen = 0;
+        sendoffset = 0;
+    }
+    m_sendFrames = 0;
     if (sendbuff)
     {
         free(sendbuff);
         sendbuff = nullptr;
         sendbufflen = 0;
         sendoffset = 0;
+        WS_TRACE_COUNTER(send_buffer, 0);
+    }
+    if (m_stream)
+    {
+        ReleaseStream(m_stream);
+        m_stream = NULL;
     }
+    m_wsSending = false;
+}
+
+void ws::WebSocketClientImplCurl::AbortSend()
+{
+    ClearSendBuff();
+    m_control.clear();
+    m_controlLeft = 0;
+    m_closeFrame.clear();
+    m_conflated.clear();
+    m_conflatedKeys.clear();
+    m_conflatedBytes = 0;
+    m_batchLen = 0;
+    m_batchFrames = 0;
+    if (m_spool)
+        m_spoolSent = m_spool->ack;    // the connection is gone, resend what was not delivered
 }
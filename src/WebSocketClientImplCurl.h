@@ -1,43 +1,33 @@
 ﻿#pragma once
+#include "FanOutRing.h"
+#include "FrameParser.h"
+#include "TimerWheel.h"
+#include "Trace.h"
 #include <curl/curl.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace ws {
 
-    enum FrameType
-    {
-        // Non-control frame.
-        Continuation = 0x0,
-        Text = 0x1,
-        Binary = 0x2,
-        NonControlReserved1 = 0x3,
-        NonControlReserved2 = 0x4,
-        NonControlReserved3 = 0x5,
-        NonControlReserved4 = 0x6,
-        NonControlReserved5 = 0x7,
-
-        // Control frame.
-        Close = 0x8,
-        Ping = 0x9,
-        Pong = 0xA,
-        ControlReserved1 = 0xB,
-        ControlReserved2 = 0xC,
-        ControlReserved3 = 0xD,
-        ControlReserved4 = 0xE,
-        ControlReserved5 = 0xF,
-    };
-
+    /**
+     * @brief Callback to pull the payload of a streamed message.
+     * @param buffer destination to fill
+     * @param size capacity of @em buffer in bytes
+     * @param opaque private pointer passed to @em SendStream()
+     * @return number of bytes written into @em buffer, 0 means no more data.
+     */
+    typedef size_t (*StreamReadCallback)(char* buffer, size_t size, void* opaque);
 
 
-    struct Message
-    {
-        Message(FrameType type, const char* data, int len) :type(type), data(data), len(len) {}
-        FrameType type;
-        const char* data;
-        int len; // size of data in bytes
-    };
-
+    class IoUringRing;
 
     class WebSocketClientImplCurl
     {
@@ -65,12 +55,51 @@ namespace ws {
 
         /**
          * @brief Connect to websocket server.
-         * @param url the websocket server url
+         * @param url the websocket server url, or @em ws+unix://<socket path>:<request path> for a server listening
+         * on a unix domain socket, e.g. @em ws+unix:///run/app.sock:/ws (@em wss+unix:// with TLS)
          * @note This function is non-blocking, it starts a thread to establish the connection and returns immediately. \n
          * The @em url string will be saved as a copy, you can release it after this function returns.
          */
         void Connect(const char* url);
 
+        /**
+         * @brief Connect to whichever of several equivalent servers completes the handshake first.
+         * @param urls websocket server urls, in order of preference
+         * @param count number of @em urls
+         * @param staggerMs delay before starting the handshake with the next url, which starts at once when all
+         * the started ones have failed
+         *
+         * Handshakes are raced in parallel, happy-eyeballs style. The first connection upgraded to websocket is
+         * kept and the other attempts are closed, then the client behaves as if connected by @em Connect(url).
+         * @em OnConnect() reports the winner, or the failure of the last attempt if none succeeded. See
+         * @em GetEndpointAttempts() for the outcome and timing of each url.
+         * @note Non-blocking as @em Connect(url), the strings are copied.
+         */
+        void Connect(const char* const* urls, int count, unsigned staggerMs = 250);
+
+        enum AttemptResult
+        {
+            AttemptNotStarted = 0,
+            AttemptWon,
+            AttemptFailed,
+            AttemptCancelled,   // closed because another url won
+        };
+
+        struct EndpointAttempt
+        {
+            std::string url;
+            AttemptResult result;
+            int64_t startUs;    // microseconds from the start of the race until this attempt started
+            int64_t elapsedUs;  // microseconds from its start until it won, failed or was cancelled
+            int64_t connectUs;  // microseconds until TCP (and TLS) connected, -1 if it did not
+        };
+
+        /**
+         * @brief Get the outcome of each url of the last @em Connect(urls, count, staggerMs).
+         * @return one entry per url, in the order they were passed, complete when @em OnConnect() is called
+         */
+        std::vector<EndpointAttempt> GetEndpointAttempts();
+
         /**
          * @brief On connect
          * @param result the connection result
@@ -85,6 +114,11 @@ namespace ws {
          *
          * Send a message which @em FrameType is @em Close to server.
          * If the connection @em State is not @em Connected, this function will do nothing.
+         * On a wss:// connection which outgoing records are not encrypted by the kernel, no frame can be written:
+         * the close is abrupt. Reading stops at once and curl shuts the TLS connection down, without a close frame
+         * and without waiting for one, so @em SetCloseTimeout() plays no part, and the server sees the
+         * connection end without a close code. Frames not received yet are lost. Use @em SetKernelTls() or
+         * @em TransportCurlWebSocket for a close handshake on wss:// connections.
          */
         void Close();
 
@@ -108,14 +142,142 @@ namespace ws {
          * This function won't block. If this function returns a positive value, please call @em SendRemaining()
          * or this function again and again until it returns 0 or -1. The em msg will be buffed, you don't have
          * to pass it again. Before finish sending the last message, new messages won't be sent.
+         *
+         * Messages longer than @em SetMaxFrameSize() are sent as a @em msg.type frame followed by @em Continuation
+         * frames. Control frames (@em Ping, @em Pong) are accepted while a message is being sent, and go on the wire
+         * at the next frame boundary. A @em Close frame waits until the message in flight has been sent.
+         */
+        int64_t Send(Message msg);
+
+        /**
+         * @brief Send a message which supersedes the earlier messages with the same key.
+         * @param key what the message is about, e.g. an instrument whose latest price it carries
+         * @param msg the message to send
+         * @return same as @em Send(), the queued messages included in the remaining bytes
+         *
+         * Unlike @em Send(), a message is accepted while another one is being sent: it waits in a queue, where a
+         * waiting message with the same key is replaced by the newer one, keeping its place. When the socket is
+         * slow only the latest value of each key goes on the wire, the replaced messages are counted in
+         * @em Statistics::conflated. Call @em SendRemaining() to flush the queue. @em Send() takes no new
+         * message until the queue is empty, and a @em Close frame waits for it. Control frames are passed to
+         * @em Send().
+         */
+        int64_t SendConflated(uint64_t key, Message msg);
+
+        /**
+         * @brief Send the same message to many clients, encoding it once.
+         * @param msg the message to send
+         * @param clients clients to send @em msg to
+         * @param count number of @em clients
+         * @param sharedMaskKey mask every copy with the same key, so the payload is masked only once
+         * @return number of clients which took the message, the others are not connected, still sending an
+         * earlier message, or failed.
+         *
+         * The frame header is built once. Each client gets the payload masked with its own key into a scratch
+         * buffer, which is written straight to its socket, and only what the socket does not take is copied
+         * into the client. Such clients return a positive value from @em SendRemaining() until the rest has
+         * been sent. Clients with a @em SetMaxFrameSize() smaller than the message, and control frames, go
+         * through @em Send() instead.
+         */
+        static size_t Broadcast(Message msg, WebSocketClientImplCurl* const* clients, size_t count,
+                                bool sharedMaskKey = false);
+
+        /**
+         * @brief Set the maximum payload size of an outgoing frame.
+         * @param size maximum payload bytes per frame, 0 means messages passed to @em Send() are never fragmented
+         * (the default), and streamed messages use 64 KB fragments.
+         *
+         * A smaller size bounds how long a control frame has to wait behind a large message, at the cost of a
+         * few header bytes per fragment. It takes effect from the next message.
+         */
+        void SetMaxFrameSize(size_t size);
+
+        /**
+         * @brief Gather data frames sent in quick succession into fewer system calls.
+         * @param delayUs longest time a frame is held back, in microseconds, 0 writes every frame at once (the
+         * default)
+         * @param maxBytes encoded bytes after which the held frames are written without waiting
+         *
+         * A frame is written at once when nothing has been written for @em delayUs, so sparse traffic sees no
+         * added latency. Frames following sooner are held, and written together by a single system call when
+         * @em delayUs have passed since the last write or @em maxBytes have gathered. Under load this trades at
+         * most @em delayUs of latency for fewer and fuller TCP segments. @em Statistics::coalesced counts the
+         * frames which shared a write, framesSent / sendCalls gives the frames per system call.
+         *
+         * While coalescing, @em Send() takes data frames while others are held or in flight, and returns the
+         * bytes not written yet, held frames included. Do not pass the message again, call @em SendRemaining(),
+         * which writes the held frames once they are due, or leave them to the timer thread, which writes them
+         * within a millisecond or two after that. @em Send() returns -1 without taking the message while
+         * @em maxBytes are held and the socket does not take more, or when it is longer than
+         * @em SetMaxFrameSize() and other frames are waiting. Control frames are never held, and a close frame
+         * flushes the held ones. No effect with @em SetSpoolFile(), which writes all the frames spooled
+         * meanwhile at once anyway.
+         * @note Call this function before @em Connect().
+         */
+        void SetWriteCoalescing(unsigned delayUs, size_t maxBytes = 64 * 1024);
+
+        /**
+         * @brief Send a message whose payload is pulled from @em read piece by piece.
+         * @param read callback to fetch the next piece of payload
+         * @param opaque private pointer for @em read
+         * @param len total payload size in bytes
+         * @param type frame type of the message
+         * @return same as @em Send(), and -1 if another message is still being sent.
+         *
+         * The payload is emitted as a fragmented message (a @em type frame followed by @em Continuation frames),
+         * each fragment is read, masked and sent on its own, so memory usage does not depend on @em len.
+         * @em read will be invoked from @em SendRemaining() until the whole payload has been sent, it must not call
+         * the send functions of this client.
+         */
+        int64_t SendStream(StreamReadCallback read, void* opaque, uint64_t len, FrameType type = Binary);
+
+        /**
+         * @brief Send the content of a file as a fragmented binary message.
+         * @param path path of the file to send
+         * @return same as @em SendStream(), and -1 if the file cannot be opened.
+         * @note The file is memory-mapped where possible, it must not be truncated until the message was sent.
          */
-        int Send(Message msg);
+        int64_t SendFile(const char* path);
 
         /**
          * @brief Send the remaining part of the last message.
          * @return same as @em Send()
          */
-        int SendRemaining();
+        int64_t SendRemaining();
+
+        /**
+         * @brief Keep outbound data frames in a memory-mapped file until they have been delivered.
+         * @param path spool file, created if missing, NULL stops spooling
+         * @param capacity bytes of encoded frames the file can hold, an existing spool keeps its own capacity
+         * @param manualAck true if the application reports delivered data by @em AcknowledgeSpool(), false if
+         * data counts as delivered once the socket took it
+         * @return false if the file cannot be created or mapped, or is not a spool file
+         *
+         * Data frames passed to @em Send() are encoded once into the file, also while disconnected or while an
+         * earlier message is being sent, and the socket is written straight from the mapping. Frames not
+         * acknowledged yet survive a lost connection or a restart of the process: reopening the file and every
+         * @em Connect() start sending again from the acknowledged offset. Replayed frames keep the masking key
+         * they were encoded with. @em Send() returns -1 while the spool is full, acknowledged data is discarded
+         * to make room. @em SendConflated(), @em SendStream(), @em SendFile() and @em Broadcast() do not work
+         * with a spool. The file is not synced to disk, it outlives the process but not the machine.
+         * @note Call this function before @em Connect(). Not supported on Windows.
+         */
+        bool SetSpoolFile(const char* path, uint64_t capacity = 64 << 20, bool manualAck = false);
+
+        /**
+         * @brief Get the spool offset at the end of the last frame spooled by @em Send().
+         * @return offset to pass to @em AcknowledgeSpool() once the server confirms that message, 0 without a
+         * spool
+         *
+         * Offsets count every byte ever spooled to the file, they only grow.
+         */
+        uint64_t GetSpoolOffset();
+
+        /**
+         * @brief Report that the server has everything spooled before @em offset.
+         * @param offset a value returned by @em GetSpoolOffset()
+         */
+        void AcknowledgeSpool(uint64_t offset);
 
         /**
          * @brief On receive
@@ -127,6 +289,236 @@ namespace ws {
          */
         virtual void OnRecv(Message msg, bool fin);
 
+        /**
+         * @brief Limit how much received data the application may hold before the client stops reading.
+         * @param maxBytes payload bytes delivered to @em OnRecv() and not released yet, 0 means no limit
+         * @param maxFrames frames delivered and not released yet, 0 means no limit
+         *
+         * Once a limit is exceeded the client stops reading the socket, so TCP flow control slows the server down.
+         * Reading resumes when both counts are at or below half of their limit. With a limit set, the application
+         * reports every frame it is done with by @em ReleaseInbound(), from any thread. After @em Close() the
+         * limits no longer apply. A receive timeout, close timeout or destroying the client ends a paused
+         * connection too.
+         * @note Call this function before @em Connect().
+         */
+        void SetInboundBudget(uint64_t maxBytes, uint64_t maxFrames);
+
+        /**
+         * @brief Report that the application is done with a received frame.
+         * @param bytes payload size of the frame, @em msg.len in @em OnRecv()
+         */
+        void ReleaseInbound(uint64_t bytes);
+
+        /**
+         * @brief On disconnect
+         *
+         * This function will be invoked when an established connection has been closed, by either side.
+         */
+        virtual void OnDisconnect();
+
+        /**
+         * @brief Record the raw inbound byte stream into a file.
+         * @param path capture file to create, NULL stops capturing
+         * @return false if the file cannot be created
+         *
+         * The file starts with the 8 bytes "WSCAP001", followed by one record per chunk handed over by the
+         * transport: the chunk size as a 4-byte unsigned integer in network byte order, then the chunk bytes.
+         * Feed the records to @em ParseInbound() to replay the traffic, see test/replay.
+         * @note Call this function before @em Connect().
+         */
+        bool SetCaptureFile(const char* path);
+
+        /**
+         * @brief Attach receive timestamps to every message delivered to @em OnRecv().
+         * @param enable true to record @em Message::kernelTime and @em Message::dispatchTime
+         * @return false if this platform can not timestamp received data
+         *
+         * The socket asks the kernel to timestamp incoming packets (SO_TIMESTAMPING, or SO_TIMESTAMPNS on older
+         * kernels), and the receive path reads the timestamp of each chunk from the control messages. The
+         * difference between both times is the delay the data spent in the socket buffer and in the library.
+         * Only the transports reading the socket themselves see the kernel timestamps, with @em TransportCurl
+         * @em kernelTime stays 0.
+         * @note Call this function before @em Connect().
+         */
+        bool SetReceiveTimestamps(bool enable);
+
+        /**
+         * @brief Publish every frame delivered to @em OnRecv() into a shared-memory ring for local consumers.
+         * @param path ring file to create or reopen, e.g. under /dev/shm, NULL stops publishing
+         * @param capacity bytes of frames the ring holds, rounded up to a power of two, an existing ring keeps
+         * its own capacity
+         * @return false if the file cannot be created or mapped, or is not a fan-out ring
+         *
+         * Processes subscribing to the same feed read the frames this client parsed with @em FanOutReader
+         * (FanOutRing.h), each at its own cursor, instead of opening connections of their own. Frames are
+         * published as they are parsed, before @em OnRecv() sees them, and carry their type, fin flag and receive
+         * timestamps. Publishing copies the frame once and takes no system call unless a reader sleeps in
+         * @em FanOutReader::Wait(). The client never waits for the readers: one falling more than @em capacity
+         * behind loses frames, see @em FanOutReader::Lost(). Frames larger than the ring are not published.
+         * @note Call this function before @em Connect(). Not supported on Windows.
+         */
+        bool SetFanOutRing(const char* path, uint64_t capacity = 16 << 20);
+
+        enum Transport
+        {
+            TransportCurl = 0,          // curl reads the socket (default)
+            TransportSocket,            // the client reads the socket itself, with recv() and poll()
+            TransportIoUring,           // multishot receive and sends through io_uring (Linux)
+            TransportIoUringSqPoll,     // as above, sends are picked up by a kernel polling thread
+            TransportCurlWebSocket,     // curl frames the messages too, with its WebSocket API
+        };
+
+        /**
+         * @brief Select how the connection is driven once the handshake has completed.
+         * @param transport the transport to use
+         * @return false if @em transport is not supported by this build
+         *
+         * With a transport other than @em TransportCurl, curl only performs the handshake and hands the socket
+         * over to the client, which then receives on the connecting thread itself. io_uring transports fall back
+         * to @em TransportSocket if the kernel refuses to set up the rings.
+         * @note Call this function before @em Connect(). wss:// connections use @em TransportCurl, since the TLS
+         * state lives in curl, unless @em TransportCurlWebSocket is selected.
+         *
+         * @em TransportCurlWebSocket leaves the protocol to libcurl (7.86 or later, built with WebSocket
+         * support): curl generates the handshake key and checks the answer, frames are received with
+         * curl_ws_recv() and sent with curl_ws_send(). Since curl encrypts what it sends, @em Send() works on
+         * every wss:// connection, without kTLS. http(s):// urls are connected as ws(s)://. The frames are
+         * parsed by curl, so @em SetCaptureFile() records nothing and they are delivered by
+         * @em DispatchInbound() rather than @em ParseInbound(); the payloads count as the bytes sent and
+         * received. @em SetMaxFrameSize(), @em SetWriteCoalescing(), @em SetIdleTimeout(), @em SetBusyPoll() and
+         * receive timestamps have no effect, @em SetSpoolFile(), @em SendStream(), @em SendFile() do not work,
+         * and @em Connect(urls, count, staggerMs) connects to the first url only.
+         */
+        bool SetTransport(Transport transport);
+
+        /**
+         * @brief Spin on the socket instead of sleeping until data arrives, for the lowest latency.
+         * @param enable true to busy-poll
+         * @param cpu CPU to pin the connection thread to, -1 leaves it unpinned
+         * @param socketBusyPollUs SO_BUSY_POLL time in microseconds, during which the kernel polls the device
+         * queue on each receive, 0 leaves it to the system setting
+         * @return false if this platform can not busy-poll
+         *
+         * The connection thread retries non-blocking receives in a loop rather than waiting in poll(), so no
+         * wakeup is paid when a message arrives, at the cost of a CPU kept busy. Give it a CPU of its own.
+         * Busy polling only applies to the transports reading the socket themselves, and always receives with
+         * recv(), so io_uring transports behave as @em TransportSocket in this mode. @em Send() writes
+         * from the calling thread as in every mode. With @em SetIdleTimeout() the thread stops spinning
+         * and sleeps once the connection has been quiet for the timeout.
+         * @note Call this function before @em Connect().
+         */
+        bool SetBusyPoll(bool enable, int cpu = -1, unsigned socketBusyPollUs = 0);
+
+        struct Statistics
+        {
+            uint64_t framesSent;        // counted once their last byte is written
+            uint64_t framesReceived;
+            uint64_t bytesSent;         // wire bytes, frame headers included
+            uint64_t bytesReceived;
+            uint64_t sendCalls;         // system calls made to send data
+            uint64_t recvCalls;         // system calls made to wait for or read data, not counted by curl transport
+            uint64_t hibernations;      // times the connection released its buffers after @em SetIdleTimeout()
+            uint64_t inboundPauses;     // times reading stopped because of @em SetInboundBudget()
+            uint64_t conflated;         // queued messages replaced by a newer one, see @em SendConflated()
+            uint64_t timeouts;          // connections given up by the timeouts of @em SetHandshakeTimeout() and others
+            uint64_t coalesced;         // data frames written along with earlier ones, see @em SetWriteCoalescing()
+        };
+
+        /**
+         * @brief Get the traffic counters of this client.
+         * @return counters since the client was created
+         *
+         * May be called while connected, from any thread. Each counter is read on its own, so counters updated
+         * together, such as @em bytesSent and @em sendCalls, may be one update apart in the snapshot.
+         */
+        Statistics GetStatistics();
+
+        /**
+         * @brief Release the buffers of the connection after it has been quiet for a while.
+         * @param milliseconds time without inbound data before the buffers are released, 0 never releases them
+         * (the default)
+         *
+         * The receive buffer (or the io_uring rings) and the parser buffers are freed, and taken again from a
+         * process-wide pool when the socket becomes readable. This keeps many idle connections cheap. Only the
+         * transports reading the socket themselves hibernate, @em TransportCurl keeps the buffers of curl.
+         * @note Call this function before @em Connect().
+         */
+        void SetIdleTimeout(unsigned milliseconds);
+
+        /**
+         * @brief Give up a connection attempt which has not completed the handshake in time.
+         * @param milliseconds time from the start of the attempt to the upgrade response, 0 leaves it to curl
+         * (the default)
+         *
+         * @em OnConnect() reports @em Timeout. The timeouts of all clients are driven by one timer thread of the
+         * process, with a hierarchical timer wheel (see TimerWheel.h), so arming and disarming them costs O(1)
+         * whatever the number of connections.
+         * @note Call this function before @em Connect().
+         */
+        void SetHandshakeTimeout(unsigned milliseconds);
+
+        /**
+         * @brief Drop a connection on which nothing has been received for a while.
+         * @param milliseconds time without inbound data, 0 keeps quiet connections open (the default)
+         *
+         * This detects a dead server or a broken path. A live server answers the pings of @em SetPingInterval(),
+         * so with a shorter ping interval only dead connections are dropped.
+         * @note Call this function before @em Connect().
+         */
+        void SetReceiveTimeout(unsigned milliseconds);
+
+        /**
+         * @brief Ping the server regularly while connected.
+         * @param milliseconds time between pings, 0 sends none (the default)
+         *
+         * The timer thread writes a ping at the next frame boundary, without waiting for a thread that is
+         * sending. While a streamed message waits for its next fragment, the ping goes ahead of it. The timer
+         * thread never pulls stream data, @em StreamReadCallback is still only called from @em SendStream() and
+         * @em SendRemaining().
+         * @note Call this function before @em Connect(). Like @em Send(), pings need a connection which frames
+         * can be written to, not a wss:// one without kTLS.
+         */
+        void SetPingInterval(unsigned milliseconds);
+
+        /**
+         * @brief Drop the connection if the server does not complete the close handshake in time.
+         * @param milliseconds time from @em Close() until the connection is dropped, 0 waits for the server
+         * (the default)
+         *
+         * Not used by an abrupt @em Close() of a wss:// connection without kTLS, which does not wait.
+         */
+        void SetCloseTimeout(unsigned milliseconds);
+
+        /**
+         * @brief Share TLS sessions with the other clients of this process.
+         * @param enable true to share (the default), false to keep a private session cache
+         *
+         * With sharing, a new wss:// connection to a host that was connected before resumes the TLS session
+         * from a cached ticket instead of running a full handshake.
+         */
+        void SetTlsSessionSharing(bool enable);
+
+        /**
+         * @brief Let the kernel encrypt and decrypt the TLS records of wss:// connections (kTLS).
+         * @param enable true to request kTLS
+         * @return false if this build or the TLS backend of curl does not support it
+         *
+         * Needs a build with WEBSOCKET_CLIENT_OPENSSL defined (link libssl and libcrypto), curl using OpenSSL, and the Linux tls
+         * module. If the kernel refuses, records are silently processed in user space as before, see
+         * @em GetKernelTlsState(). @em Send() on a wss:// connection needs the kernel to encrypt outgoing records,
+         * it writes plain frames to the socket and fails otherwise.
+         * @note Call this function before @em Connect().
+         */
+        bool SetKernelTls(bool enable);
+
+        /**
+         * @brief Check which directions of the TLS connection are handled by the kernel.
+         * @param send set to whether outgoing records are encrypted by the kernel
+         * @param recv set to whether incoming records are decrypted by the kernel
+         * @return false if the client is not connected over TLS, or this build can not tell
+         */
+        bool GetKernelTlsState(bool* send, bool* recv);
+
     protected:
         /**
          * @brief Get the status code of HTTP response
@@ -134,29 +526,311 @@ namespace ws {
          */
         long GetResponseCode();
 
+        /**
+         * @brief Get the curl easy handle of this client.
+         * @return the handle, to set extra options (e.g. certificate verification) before @em Connect()
+         */
+        CURL* GetCurlHandle();
+
+        /**
+         * @brief Get the socket of the connection, valid while the @em State is @em Connected.
+         */
+        curl_socket_t GetSocket();
+
+        /**
+         * @brief Same as @em Send(), telling whether @em msg was taken.
+         * @param taken set to false if @em msg was not taken, because a message still in flight was flushed
+         * instead or the call failed
+         */
+        int64_t Send(Message msg, bool& taken);
+
+        /**
+         * @brief Count a frame delivered by @em ParseInbound() against the inbound budget.
+         */
+        void CountInbound(size_t len)
+        {
+            ++m_inboundFrames;
+            m_inboundPayload += len;
+        }
+
+        /**
+         * @brief Fill the receive timestamps of a frame about to be delivered by @em ParseInbound().
+         */
+        void StampInbound(Message& msg)
+        {
+            if (!m_timestamps)
+                return;
+            msg.kernelTime = m_kernelTime;
+            msg.dispatchTime = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+        }
+
+        /**
+         * @brief Copy a frame about to be delivered by @em ParseInbound() into the ring of @em SetFanOutRing().
+         */
+        void PublishInbound(const Message& msg, bool fin)
+        {
+            if (m_fanOut.IsOpen())
+                m_fanOut.Publish(msg, fin);
+        }
+
+        /**
+         * @brief Parse a chunk of the inbound byte stream.
+         * @param data bytes received from server
+         * @param datalen size of @em data in bytes
+         * @return number of frames parsed
+         *
+         * Complete frames are delivered to @em OnRecv(), an incomplete frame at the end is kept until the next
+         * chunk arrives. Called for every chunk received, and for replaying captured traffic.
+         * @em BasicWebSocketClient overrides it to dispatch frames without virtual calls.
+         */
+        virtual size_t ParseInbound(const char* data, size_t datalen);
+
+        /**
+         * @brief Deliver a frame parsed by curl with @em TransportCurlWebSocket.
+         * @param msg complete frame
+         * @param fin if this data frame is a last frame
+         *
+         * Counts the frame against the inbound budget and calls @em OnRecv(). @em BasicWebSocketClient
+         * overrides it as @em ParseInbound().
+         */
+        virtual void DispatchInbound(Message msg, bool fin);
+
+        /**
+         * @brief Drop the incomplete frame kept by @em ParseInbound(), called when connecting.
+         */
+        virtual void ResetInbound();
+
+        /**
+         * @brief Free the spare memory of @em ParseInbound(), called when the connection goes idle.
+         */
+        virtual void CompactInbound();
+
     private:
         static curl_socket_t OpenSocketCallback(void *clientp, curlsocktype purpose, struct curl_sockaddr *address);
         static size_t OnHeaderReceived(char *buffer, size_t size, size_t nitems, void *userdata);
         static size_t OnMessageReceived(char *ptr, size_t size, size_t nmemb, void *userdata);
+        static int CloseSocketCallback(void *clientp, curl_socket_t item);
+        static int ProgressCallback(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow);
         static void RecvProc(void* userdata);
 
+        // Callbacks of the easy handles racing in Connect(urls, count, staggerMs), @em clientp is a RaceAttempt.
+        struct RaceAttempt;
+        static curl_socket_t RaceOpenSocket(void* clientp, curlsocktype purpose, struct curl_sockaddr* address);
+        static size_t RaceHeader(char* buffer, size_t size, size_t nitems, void* userdata);
+        static size_t RaceWrite(char* ptr, size_t size, size_t nmemb, void* userdata);
+        static int RaceCloseSocket(void* clientp, curl_socket_t item);
+        static int RaceProgress(void* clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow);
+        CURLcode RaceConnect();
+        void FinishAttempt(RaceAttempt* attempt, AttemptResult result);
+
         static void ConnProc(WebSocketClientImplCurl* pthis);
 
         void SetState(State newState);
+        curl_socket_t OpenSocket(struct curl_sockaddr* address);
+        void OnInbound(const char* data, size_t len);
+        void CaptureInbound(const char* data, size_t len);
+        void CheckTls();
+        void RecvLoop();
+        void RecvLoopCurlWs();
+        int64_t RecvStamped(char* buff, size_t len);
+        int RecvLoopIoUring();
+        void Hibernate();
+        bool OverInboundBudget();
+        bool BelowInboundWatermark();
+        void WaitInboundBudget();
+        void WakeInbound();
 
-        CURL* m_curl;
+        CURL* m_curl;     // replaced by the winning handle while a raced connection lasts
         curl_slist* m_header_list_ptr;
         curl_socket_t m_sockfd;   // send message to server through this fd
 
         State m_state;    // connection state
+        Transport m_transport;
+        // Both are written by the timer thread and Close() too, read by the connection thread.
+        std::atomic<bool> m_detached;   // curl hands the socket over to the client after the handshake
+        bool m_tls;
+        std::atomic<bool> m_abort;      // stop the transfer at the next progress callback
+        bool m_ktlsSend;
+        bool m_ktlsRecv;
+        unsigned m_idleTimeout;   // milliseconds, 0 if the connection never hibernates
+        bool m_timestamps;        // see SetReceiveTimestamps()
+        uint64_t m_kernelTime;    // kernel receive time of the chunk being parsed
+        bool m_busyPoll;          // see SetBusyPoll()
+        int m_busyPollCpu;
+        unsigned m_socketBusyPoll;
 
-        std::string buffer;
+        // Counters of Statistics, bumped by the receiving, sending and timer threads without a common lock.
+        struct Counter
+        {
+            std::atomic<uint64_t> value;
+            Counter() : value(0) {}
+            void operator++() { value.fetch_add(1, std::memory_order_relaxed); }
+            void operator+=(uint64_t n) { value.fetch_add(n, std::memory_order_relaxed); }
+            uint64_t Load() const { return value.load(std::memory_order_relaxed); }
+        };
+        struct Counters
+        {
+            Counter framesSent;
+            Counter framesReceived;
+            Counter bytesSent;
+            Counter bytesReceived;
+            Counter sendCalls;
+            Counter recvCalls;
+            Counter hibernations;
+            Counter inboundPauses;
+            Counter conflated;
+            Counter timeouts;
+            Counter coalesced;
+        };
+        Counters m_stats;
+
+        // Connect(urls, count, staggerMs), the race is run by the connecting thread.
+        std::vector<std::string> m_endpoints;
+        unsigned m_staggerMs;
+        std::vector<EndpointAttempt> m_attempts;
+        std::mutex m_attemptsMutex;
+        RaceAttempt* m_raceWinner;
+
+        FrameParser<> m_parser;
+        uint64_t m_inboundFrames;    // delivered by the chunk being parsed
+        uint64_t m_inboundPayload;
+
+        // Inbound budget, see SetInboundBudget().
+        uint64_t m_maxInboundBytes;
+        uint64_t m_maxInboundFrames;
+        std::atomic<int64_t> m_heldBytes;     // delivered and not released, may drop below 0 for a moment
+        std::atomic<int64_t> m_heldFrames;
+        std::atomic<bool> m_inboundPaused;
+        std::atomic<bool> m_inboundClosing;   // Close() was called, stop enforcing the budget
+        std::mutex m_inboundMutex;
+        std::condition_variable m_inboundCond;
+
+        FILE* m_capture;    // inbound capture file, NULL if not capturing
+
+        std::mutex m_sendMutex;   // guards all the outbound state below
 
         char* sendbuff;
-        int sendbufflen;
-        int sendoffset;
+        size_t sendbufflen;
+        size_t sendoffset;
+        uint64_t m_sendFrames;      // frames ending in sendbuff, counted in the statistics once it is written
+
+        // Payload source of a message being sent by fragments.
+        struct OutboundStream
+        {
+            StreamReadCallback read;    // NULL if the payload is at @em data
+            void* opaque;
+            const char* data;
+            bool mapped;                // @em data is a file mapping
+            char* copy;                 // payload copied by @em Send(), freed with the stream
+            FILE* file;                 // file opened by @em SendFile() for @em read
+            uint64_t len;               // total payload size
+            uint64_t offset;            // payload bytes already framed
+            size_t chunk;               // payload size of each fragment
+            FrameType type;
+        };
+        OutboundStream* m_stream;
+        size_t m_maxFrameSize;
+        IoUringRing* m_sendRing;    // sends go through this ring with io_uring transports
+
+        std::string m_control;      // encoded control frames waiting for a frame boundary
+        size_t m_controlLeft;       // bytes of the first frame of m_control, if part of it was written
+        std::string m_closeFrame;   // encoded close frame waiting for the message in flight
+
+        // Messages of SendConflated() waiting for the message in flight, at most one per key.
+        struct ConflatedMessage
+        {
+            uint64_t key;
+            FrameType type;
+            std::string payload;
+        };
+        typedef std::list<ConflatedMessage> ConflatedList;
+        ConflatedList m_conflated;
+        std::unordered_map<uint64_t, ConflatedList::iterator> m_conflatedKeys;
+        uint64_t m_conflatedBytes;  // counted in the remaining bytes, headers at their largest
+
+        // Encoded frames of SetWriteCoalescing() held back to share a write, handed to the send buffer at once.
+        unsigned m_coalesceDelay;   // microseconds, 0 if not coalescing
+        size_t m_coalesceBytes;
+        char* m_batch;
+        size_t m_batchLen;
+        size_t m_batchCap;
+        uint64_t m_batchFrames;
+        uint64_t m_lastFlush;       // microseconds of the steady clock when the last batch was handed over
+        TimerNode m_flushTimer;     // writes the held frames if the application does not
+
+        // Spool of SetSpoolFile(), sendbuff points into its mapping while m_sendFromSpool is set.
+        struct SpoolHeader;
+        SpoolHeader* m_spool;       // start of the mapping, NULL without a spool
+        char* m_spoolData;          // the frames, after the header page
+        size_t m_spoolMapped;
+        uint64_t m_spoolSent;       // spool offset up to which frames were handed to the send buffer
+        bool m_spoolManualAck;
+        bool m_sendFromSpool;
+
+        FanOutWriter m_fanOut;      // ring of SetFanOutRing(), written by the receive thread
+
+        // TransportCurlWebSocket: sendbuff holds the bare payload of a message, m_control and m_closeFrame hold
+        // control frames as type, length and payload bytes, curl frames them.
+        curl_slist* m_wsHeaders;    // the custom headers without those curl generates
+        FrameType m_wsType;         // type of the message in sendbuff
+        bool m_wsSending;           // a message is in sendbuff, which may be empty
+        bool m_wsContinued;         // the last data frame received was not final
+        std::string m_wsFrame;      // frame received in pieces
+
+        // Timeouts, armed in the wheel of the timer thread.
+        unsigned m_handshakeTimeout;
+        unsigned m_receiveTimeout;
+        unsigned m_pingInterval;
+        unsigned m_closeTimeout;
+        TimerNode m_handshakeTimer;
+        TimerNode m_receiveTimer;
+        TimerNode m_pingTimer;
+        TimerNode m_closeTimer;
+        std::atomic<uint64_t> m_lastInbound;    // timer tick of the last inbound data
+        curl_socket_t m_timerSocket;            // socket the timers shut down, guarded by the timer lock
+        CURLM* m_timerMulti;                    // race the timers wake up, guarded by the timer lock
+        std::atomic<bool> m_timedOut;           // the handshake timer expired
+        std::atomic<bool> m_pingDue;            // the ping timer expired, the ping is not queued yet
+        std::atomic<int> m_connThreads;         // ConnProc() threads started and not returned yet
+
+        static void OnTimer(TimerNode* node);
+        static void OnDeferred(void* opaque);
+        void TimerExpired(TimerNode* timer);
+        void Abort();
+        void SendDeferred();
+        void SetTimerSocket(curl_socket_t sockfd);
+        void ForgetTimerSocket(curl_socket_t sockfd);
+        void SetTimerMulti(CURLM* multi);
+        void StartConnectionTimers();
+        void StopTimers();
+
+        int64_t SpoolMessage(Message msg);
+        bool LoadSpool();
+        void AckSpool(uint64_t offset);
+        void ResetSpool();
+        void CloseSpool();
+        uint64_t SpoolUnsent();
 
+        bool QueueControl(Message msg);
+        bool LoadMessage(Message msg);
+        bool LoadConflated();
+        int64_t SendCoalesced(Message msg);
+        bool FlushDue();
+        void LoadBatch();
+        void ArmFlushTimer();
+        bool LoadStream(OutboundStream* stream);
+        OutboundStream* NewStream(FrameType type, uint64_t len);
+        int64_t StartStream(OutboundStream* stream);
+        static void ReleaseStream(OutboundStream* stream);
+        bool FillStreamFrame();
+        int64_t SendPieces(const char** pieces, const size_t* lens, int count);
+        int64_t SendPending(bool pullStream = true);
+        void ControlWritten(size_t n);
+        int64_t SendPendingCurlWs();
+        int64_t SendEncoded(const char* frame, size_t len);
         void ClearSendBuff();
+        void AbortSend();
     };
 
 }
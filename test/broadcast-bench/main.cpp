@@ -0,0 +1,125 @@
+#include "WebSocketClientImplCurl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace ws;
+
+// CPU cost of sending one payload to many connections: a Send() per client, Broadcast(), and Broadcast() with
+// one masking key. Run it against test/echo-server; the echoes are awaited between fan-outs, only the CPU time
+// of the sending thread is measured.
+
+class FanClient : public WebSocketClientImplCurl
+{
+public:
+    FanClient() : connected(false), failed(false), received(0) {}
+    virtual void OnConnect(ConnectResult result) override
+    {
+        if (result == Success)
+            connected = true;
+        else
+            failed = true;
+    }
+    virtual void OnRecv(Message msg, bool fin) override
+    {
+        if (fin)
+            ++received;
+    }
+
+    std::atomic<bool> connected;
+    std::atomic<bool> failed;
+    std::atomic<int> received;
+};
+
+static double ThreadCpuSeconds()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+enum Mode { PerClientSend, BroadcastOwnKeys, BroadcastSharedKey };
+static const char* names[] = { "Send() per client", "Broadcast()", "Broadcast() shared key" };
+
+static void Run(Mode mode, std::vector<FanClient*>& clients, size_t size, int rounds)
+{
+    std::vector<WebSocketClientImplCurl*> targets(clients.begin(), clients.end());
+    std::string payload(size, 'x');
+    Message msg(Binary, payload.data(), payload.size());
+    double cpu = 0;
+    int expected = clients[0]->received;
+    for (int round = 0; round < rounds; ++round)
+    {
+        double begin = ThreadCpuSeconds();
+        if (mode == PerClientSend)
+        {
+            for (size_t i = 0; i < clients.size(); ++i)
+                clients[i]->Send(msg);
+        }
+        else
+        {
+            WebSocketClientImplCurl::Broadcast(msg, targets.data(), targets.size(), mode == BroadcastSharedKey);
+        }
+        for (size_t i = 0; i < clients.size(); ++i)
+        {
+            while (clients[i]->SendRemaining() > 0)
+                ;
+        }
+        cpu += ThreadCpuSeconds() - begin;
+        ++expected;
+        for (size_t i = 0; i < clients.size(); ++i)
+        {
+            while (clients[i]->received < expected)
+                std::this_thread::yield();
+        }
+    }
+    printf("%-24s %8.1f us CPU per fan-out   %6.1f ns per client-KB\n", names[mode], cpu / rounds * 1e6,
+           cpu / rounds / clients.size() / (size / 1024.0) * 1e9);
+}
+
+int main(int argc, char *argv[])
+{
+    const char* url = argc > 1 ? argv[1] : "http://127.0.0.1:8000/ws";
+    int count = argc > 2 ? atoi(argv[2]) : 200;
+    size_t size = argc > 3 ? atoi(argv[3]) : 16384;
+    int rounds = argc > 4 ? atoi(argv[4]) : 200;
+
+    std::vector<FanClient*> clients;
+    for (int i = 0; i < count; ++i)
+    {
+        FanClient* client = new FanClient();
+        client->SetTransport(WebSocketClientImplCurl::TransportSocket);
+        client->Connect(url);
+        clients.push_back(client);
+    }
+    for (int i = 0; i < count; ++i)
+    {
+        while (!clients[i]->connected && !clients[i]->failed)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        if (clients[i]->failed)
+        {
+            printf("connect failed\n");
+            return 1;
+        }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    printf("%s, %d clients, %zu bytes per message, %d fan-outs\n", url, count, size, rounds);
+    Run(PerClientSend, clients, size, rounds);
+    Run(BroadcastOwnKeys, clients, size, rounds);
+    Run(BroadcastSharedKey, clients, size, rounds);
+
+    for (int i = 0; i < count; ++i)
+        clients[i]->Close();
+    for (int i = 0; i < count; ++i)
+    {
+        while (clients[i]->GetState() != WebSocketClientImplCurl::Disconnected)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        delete clients[i];
+    }
+    return 0;
+}
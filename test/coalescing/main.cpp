@@ -0,0 +1,148 @@
+#include "WebSocketClientImplCurl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace ws;
+
+// Sends messages at a few rates to test/echo-server, once writing every frame at once and once with
+// SetWriteCoalescing(), and compares the frames per system call, the round trip times and the CPU time the
+// sending thread spends per message.
+
+static int64_t NowUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int64_t ThreadCpuUs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+class EchoClient : public WebSocketClientImplCurl
+{
+public:
+    EchoClient() : connected(false), failed(false) {}
+    virtual void OnConnect(ConnectResult result) override
+    {
+        if (result == Success)
+            connected = true;
+        else
+            failed = true;
+    }
+    virtual void OnRecv(Message msg, bool fin) override
+    {
+        if (msg.type != Binary || msg.len < sizeof(int64_t))
+            return;
+        int64_t produced;
+        memcpy(&produced, msg.data, sizeof(produced));
+        std::lock_guard<std::mutex> lock(mutex);
+        rtt.push_back(NowUs() - produced);
+    }
+
+    std::atomic<bool> connected;
+    std::atomic<bool> failed;
+    std::mutex mutex;
+    std::vector<int64_t> rtt;   // microseconds from producing a message to receiving its echo
+};
+
+static void Run(const char* url, int rate, unsigned delayUs, size_t size, int seconds)
+{
+    EchoClient client;
+    client.SetTransport(WebSocketClientImplCurl::TransportSocket);
+    if (delayUs)
+        client.SetWriteCoalescing(delayUs);
+    client.Connect(url);
+    while (!client.connected && !client.failed)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    if (client.failed)
+    {
+        printf("connect failed\n");
+        exit(1);
+    }
+
+    std::string payload(size, 'x');
+    std::deque<int64_t> backlog;    // production times of the messages not taken by the client yet
+    uint64_t produced = 0;
+    int64_t cpu = ThreadCpuUs();
+    int64_t begin = NowUs();
+    int64_t end = begin + seconds * 1000000LL;
+    for (int64_t now = begin; now < end; now = NowUs())
+    {
+        uint64_t due = (uint64_t)((now - begin) * rate / 1000000);
+        for (; produced < due; ++produced)
+            backlog.push_back(NowUs());
+        while (!backlog.empty())
+        {
+            // Without coalescing a message is only taken once the previous one is out.
+            if (!delayUs && client.SendRemaining() != 0)
+                break;
+            memcpy(&payload[0], &backlog.front(), sizeof(int64_t));
+            if (client.Send(Message(Binary, payload.data(), payload.size())) < 0)
+                break;
+            backlog.pop_front();
+        }
+        client.SendRemaining();
+        std::this_thread::sleep_for(std::chrono::microseconds(20));
+    }
+    cpu = ThreadCpuUs() - cpu;
+    while (client.SendRemaining() > 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    WebSocketClientImplCurl::Statistics stats = client.GetStatistics();
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    client.Close();
+    while (client.GetState() != WebSocketClientImplCurl::Disconnected)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    std::vector<int64_t>& rtt = client.rtt;
+    std::sort(rtt.begin(), rtt.end());
+    if (rtt.empty())
+        rtt.push_back(0);
+    char mode[32];
+    if (delayUs)
+        snprintf(mode, sizeof(mode), "coalesce %u us", delayUs);
+    else
+        snprintf(mode, sizeof(mode), "immediate");
+    printf("%8d msg/s  %-16s %6.2f frames/syscall %8llu coalesced   rtt p50 %8.1f us  p99 %8.1f us   cpu %6.2f us/msg\n",
+           rate, mode, stats.sendCalls ? (double)stats.framesSent / stats.sendCalls : 0.0,
+           (unsigned long long)stats.coalesced, (double)rtt[rtt.size() / 2], (double)rtt[rtt.size() * 99 / 100],
+           stats.framesSent ? (double)cpu / stats.framesSent : 0.0);
+}
+
+int main(int argc, char *argv[])
+{
+    const char* url = argc > 1 ? argv[1] : "http://127.0.0.1:8000/ws";
+    unsigned delayUs = argc > 2 ? atoi(argv[2]) : 200;
+    size_t size = argc > 3 ? atoi(argv[3]) : 64;
+    int seconds = argc > 4 ? atoi(argv[4]) : 3;
+    std::vector<int> rates;
+    for (int i = 5; i < argc; ++i)
+        rates.push_back(atoi(argv[i]));
+    if (rates.empty())
+    {
+        rates.push_back(1000);
+        rates.push_back(20000);
+        rates.push_back(100000);
+    }
+    if (size < sizeof(int64_t))
+        size = sizeof(int64_t);
+
+    printf("%s, %zu byte messages, %d s per run\n", url, size, seconds);
+    for (size_t i = 0; i < rates.size(); ++i)
+    {
+        Run(url, rates[i], 0, size, seconds);
+        Run(url, rates[i], delayUs, size, seconds);
+    }
+    return 0;
+}
@@ -0,0 +1,153 @@
+#include "WebSocketClientImplCurl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace ws;
+
+// Sends a stream of updates to a few keys over a slow connection, once queuing every update in the application
+// and once with SendConflated(), and compares how stale the values are when they come back from test/echo-server.
+
+struct Update
+{
+    uint64_t key;
+    uint64_t seq;
+    int64_t produced;   // microseconds, steady clock
+};
+
+static int64_t NowUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class UpdateClient : public WebSocketClientImplCurl
+{
+public:
+    UpdateClient() : connected(false), failed(false) {}
+    virtual void OnConnect(ConnectResult result) override
+    {
+        if (result == Success)
+            connected = true;
+        else
+            failed = true;
+    }
+    virtual void OnRecv(Message msg, bool fin) override
+    {
+        if (msg.len < sizeof(Update))
+            return;
+        Update update;
+        memcpy(&update, msg.data, sizeof(update));
+        std::lock_guard<std::mutex> lock(mutex);
+        staleness.push_back(NowUs() - update.produced);
+    }
+
+    // Shrink the send buffer of the socket, so the updates wait in the client rather than in the kernel.
+    void SetSendWindow(int* window)
+    {
+        curl_easy_setopt(GetCurlHandle(), CURLOPT_SOCKOPTFUNCTION, SockOptCallback);
+        curl_easy_setopt(GetCurlHandle(), CURLOPT_SOCKOPTDATA, window);
+    }
+    static int SockOptCallback(void* clientp, curl_socket_t fd, curlsocktype purpose)
+    {
+        int window = *(int*)clientp;
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &window, sizeof(window));
+        return CURL_SOCKOPT_OK;
+    }
+
+    std::atomic<bool> connected;
+    std::atomic<bool> failed;
+    std::mutex mutex;
+    std::vector<int64_t> staleness;     // microseconds from producing an update to receiving its echo
+};
+
+static void Run(const char* url, bool conflate, int keys, int rate, size_t size, int seconds, int window)
+{
+    UpdateClient client;
+    client.SetTransport(WebSocketClientImplCurl::TransportSocket);
+    if (window)
+        client.SetSendWindow(&window);
+    client.Connect(url);
+    while (!client.connected && !client.failed)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    if (client.failed)
+    {
+        printf("connect failed\n");
+        exit(1);
+    }
+
+    std::string payload(size, 'x');
+    std::deque<std::string> backlog;    // updates waiting in the application, without conflation
+    uint64_t produced = 0;
+    int64_t begin = NowUs();
+    int64_t end = begin + seconds * 1000000LL;
+    for (int64_t now = begin; now < end; now = NowUs())
+    {
+        uint64_t due = (uint64_t)((now - begin) * rate / 1000000);
+        for (; produced < due; ++produced)
+        {
+            Update update = { produced % keys, produced, NowUs() };
+            memcpy(&payload[0], &update, sizeof(update));
+            if (conflate)
+                client.SendConflated(update.key, Message(Binary, payload.data(), payload.size()));
+            else
+                backlog.push_back(payload);
+        }
+        if (conflate)
+        {
+            client.SendRemaining();
+        }
+        else
+        {
+            while (!backlog.empty() && client.SendRemaining() == 0)
+            {
+                client.Send(Message(Binary, backlog.front().data(), backlog.front().size()));
+                backlog.pop_front();
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    size_t left = backlog.size();
+    while (client.SendRemaining() > 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    WebSocketClientImplCurl::Statistics stats = client.GetStatistics();
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    client.Close();
+    while (client.GetState() != WebSocketClientImplCurl::Disconnected)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    std::vector<int64_t>& staleness = client.staleness;
+    std::sort(staleness.begin(), staleness.end());
+    if (staleness.empty())
+        staleness.push_back(0);
+    printf("%-16s %8llu produced %8llu on wire %8llu conflated %8zu left queued   staleness p50 %8.1f ms  p99 %8.1f ms\n",
+           conflate ? "SendConflated()" : "queue all",
+           (unsigned long long)produced, (unsigned long long)stats.framesSent,
+           (unsigned long long)stats.conflated, left,
+           staleness[staleness.size() / 2] / 1000.0, staleness[staleness.size() * 99 / 100] / 1000.0);
+}
+
+int main(int argc, char *argv[])
+{
+    const char* url = argc > 1 ? argv[1] : "http://127.0.0.1:8000/ws";
+    int keys = argc > 2 ? atoi(argv[2]) : 16;
+    int rate = argc > 3 ? atoi(argv[3]) : 20000;
+    size_t size = argc > 4 ? atoi(argv[4]) : 256;
+    int seconds = argc > 5 ? atoi(argv[5]) : 3;
+    int window = argc > 6 ? atoi(argv[6]) : 16384;
+    if (size < sizeof(Update))
+        size = sizeof(Update);
+
+    printf("%s, %d keys, %d updates/s of %zu bytes, %d s, send buffer %d\n", url, keys, rate, size, seconds, window);
+    Run(url, false, keys, rate, size, seconds, window);
+    Run(url, true, keys, rate, size, seconds, window);
+    return 0;
+}
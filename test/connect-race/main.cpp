@@ -0,0 +1,83 @@
+#include "WebSocketClientImplCurl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace ws;
+
+// Races the handshakes with several urls and reports the winner and the timing of each attempt, then checks
+// that the winning connection echoes a message. Run it against test/echo-server, e.g. one url direct, one
+// through test/impair-proxy with a delay, and one refused.
+
+typedef std::chrono::steady_clock Clock;
+
+class RaceClient : public WebSocketClientImplCurl
+{
+public:
+    RaceClient() : done(false), result(Reject), echoed(0) {}
+    virtual void OnConnect(ConnectResult result) override
+    {
+        this->result = result;
+        done = true;
+    }
+    virtual void OnRecv(Message msg, bool fin) override
+    {
+        if (msg.len == 4 && memcmp(msg.data, "ping", 4) == 0)
+            ++echoed;
+    }
+
+    std::atomic<bool> done;
+    std::atomic<ConnectResult> result;
+    std::atomic<int> echoed;
+};
+
+static const char* outcomes[] = { "not started", "won", "failed", "cancelled" };
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        printf("usage: %s <stagger ms> <url> [url...]\n", argv[0]);
+        return 1;
+    }
+    unsigned stagger = atoi(argv[1]);
+    std::vector<const char*> urls(argv + 2, argv + argc);
+
+    RaceClient client;
+    client.SetTransport(WebSocketClientImplCurl::TransportSocket);
+    Clock::time_point begin = Clock::now();
+    client.Connect(urls.data(), (int)urls.size(), stagger);
+    while (!client.done)
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    double ms = std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+
+    static const char* results[] = { "Success", "Timeout", "Reject" };
+    printf("OnConnect(%s) after %.2f ms\n", results[client.result], ms);
+    std::vector<WebSocketClientImplCurl::EndpointAttempt> attempts = client.GetEndpointAttempts();
+    for (size_t i = 0; i < attempts.size(); ++i)
+    {
+        const WebSocketClientImplCurl::EndpointAttempt& attempt = attempts[i];
+        printf("  %-32s %-11s", attempt.url.c_str(), outcomes[attempt.result]);
+        if (attempt.startUs >= 0)
+            printf("  started +%6.2f ms  took %7.2f ms", attempt.startUs / 1000.0, attempt.elapsedUs / 1000.0);
+        if (attempt.connectUs >= 0)
+            printf("  tcp/tls connected in %.2f ms", attempt.connectUs / 1000.0);
+        printf("\n");
+    }
+    if (client.result != WebSocketClientImplCurl::Success)
+        return 1;
+
+    client.Send(Message(Text, "ping", 4));
+    Clock::time_point deadline = Clock::now() + std::chrono::seconds(5);
+    while (!client.echoed && Clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    printf("echo %s\n", client.echoed ? "received" : "MISSING");
+    client.Close();
+    while (client.GetState() != WebSocketClientImplCurl::Disconnected)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    return client.echoed ? 0 : 1;
+}
@@ -0,0 +1,132 @@
+#include "CoroWebSocketClient.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <vector>
+using namespace ws;
+
+// Request/response round trips against test/echo-server: a coroutine awaiting Send()/Recv(), and a callback
+// client handing every reply over to a waiting thread.
+
+typedef std::chrono::steady_clock Clock;
+
+static void Report(const char* name, std::vector<double>& rtt)
+{
+    if (rtt.empty())
+    {
+        printf("%-20s failed\n", name);
+        return;
+    }
+    std::sort(rtt.begin(), rtt.end());
+    double sum = 0;
+    for (double t : rtt)
+        sum += t;
+    printf("%-20s mean %7.2f us   p50 %7.2f us   p99 %7.2f us\n", name, sum / rtt.size(), rtt[rtt.size() / 2],
+           rtt[rtt.size() * 99 / 100]);
+}
+
+static Task RoundTrips(CoroWebSocketClient& client, const char* url, int count, std::vector<double>& rtt,
+                       std::atomic<bool>& done)
+{
+    if (co_await client.Connect(url) == WebSocketClientImplCurl::Success)
+    {
+        std::string request(64, 'q');
+        for (int i = 0; i < count; ++i)
+        {
+            Clock::time_point begin = Clock::now();
+            if (co_await client.Send(Message(Binary, request.data(), request.size())) != 0)
+                break;
+            std::optional<CoroWebSocketClient::Frame> reply = co_await client.Recv();
+            if (!reply)
+                break;
+            rtt.push_back(std::chrono::duration<double, std::micro>(Clock::now() - begin).count());
+        }
+    }
+    done = true;
+}
+
+class HandoffClient : public WebSocketClientImplCurl
+{
+public:
+    HandoffClient() : connected(false), failed(false), replies(0) {}
+    virtual void OnConnect(ConnectResult result) override
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (result == Success)
+            connected = true;
+        else
+            failed = true;
+        cond.notify_one();
+    }
+    virtual void OnRecv(Message msg, bool fin) override
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++replies;
+        cond.notify_one();
+    }
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool connected;
+    bool failed;
+    int replies;
+};
+
+static void Handoff(const char* url, int count, std::vector<double>& rtt)
+{
+    HandoffClient client;
+    client.SetTransport(WebSocketClientImplCurl::TransportSocket);
+    client.Connect(url);
+    std::unique_lock<std::mutex> lock(client.mutex);
+    client.cond.wait(lock, [&] { return client.connected || client.failed; });
+    if (client.failed)
+        return;
+    std::string request(64, 'q');
+    for (int i = 0; i < count; ++i)
+    {
+        Clock::time_point begin = Clock::now();
+        lock.unlock();
+        int64_t remaining = client.Send(Message(Binary, request.data(), request.size()));
+        while (remaining > 0)
+            remaining = client.SendRemaining();
+        lock.lock();
+        if (remaining < 0)
+            return;
+        client.cond.wait(lock, [&] { return client.replies > i; });
+        rtt.push_back(std::chrono::duration<double, std::micro>(Clock::now() - begin).count());
+    }
+    lock.unlock();
+    client.Close();
+    while (client.GetState() != WebSocketClientImplCurl::Disconnected)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+int main(int argc, char *argv[])
+{
+    const char* url = argc > 1 ? argv[1] : "http://127.0.0.1:8000/ws";
+    int count = argc > 2 ? atoi(argv[2]) : 20000;
+
+    printf("%s, %d round trips of 64 bytes\n", url, count);
+    {
+        CoroWebSocketClient client;
+        client.SetTransport(WebSocketClientImplCurl::TransportSocket);
+        std::vector<double> rtt;
+        std::atomic<bool> done(false);
+        RoundTrips(client, url, count, rtt, done);
+        while (!done)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        Report("coroutine", rtt);
+        client.Close();
+        while (client.GetState() != WebSocketClientImplCurl::Disconnected)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    {
+        std::vector<double> rtt;
+        Handoff(url, count, rtt);
+        Report("callback + handoff", rtt);
+    }
+    return 0;
+}
@@ -0,0 +1,97 @@
+#include "BasicWebSocketClient.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <string>
+using namespace ws;
+
+// Cost of delivering small inbound frames: virtual OnRecv() against the statically dispatched
+// BasicWebSocketClient, fed from memory so only parsing and dispatch are measured.
+
+class VirtualClient : public WebSocketClientImplCurl
+{
+public:
+    VirtualClient() : sum(0) {}
+    virtual void OnRecv(Message msg, bool fin) override
+    {
+        sum += msg.len + (unsigned char)msg.data[0];
+    }
+    size_t Feed(const char* data, size_t len) { return ParseInbound(data, len); }
+
+    uint64_t sum;
+};
+
+template <class Options>
+class StaticClient : public BasicWebSocketClient<StaticClient<Options>, Options>
+{
+public:
+    StaticClient() : sum(0) {}
+    void OnFrame(Message msg, bool fin)
+    {
+        sum += msg.len + (unsigned char)msg.data[0];
+    }
+    size_t Feed(const char* data, size_t len) { return this->ParseInbound(data, len); }
+
+    uint64_t sum;
+};
+
+struct BinaryOptions : FrameParserOptions
+{
+    static const bool unmask = false;
+    static const bool binaryOnly = true;
+};
+
+template <class Client>
+static void Run(const char* name, const std::string& stream, size_t chunk, int iterations, uint64_t framesPerPass)
+{
+    Client client;
+    uint64_t frames = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+    {
+        for (size_t pos = 0; pos < stream.size(); pos += chunk)
+        {
+            size_t len = stream.size() - pos < chunk ? stream.size() - pos : chunk;
+            frames += client.Feed(stream.data() + pos, len);
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    if (frames != framesPerPass * iterations)
+        printf("%-24s parsed %llu frames, expected %llu\n", name, (unsigned long long)frames,
+               (unsigned long long)(framesPerPass * iterations));
+    printf("%-24s %8.2f ns/frame %9.1f Mframes/s   (checksum %llu)\n", name, seconds * 1e9 / frames,
+           frames / seconds / 1e6, (unsigned long long)client.sum);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t size = argc > 1 ? atoi(argv[1]) : 16;
+    int count = argc > 2 ? atoi(argv[2]) : 100000;
+    int iterations = argc > 3 ? atoi(argv[3]) : 100;
+    size_t chunk = 64 * 1024;   // one read of the socket transport
+
+    // Unmasked binary frames, as a server sends them.
+    std::string stream;
+    std::string payload(size, 'x');
+    for (int i = 0; i < count; ++i)
+    {
+        stream += (char)0x82;
+        if (size <= 125)
+        {
+            stream += (char)size;
+        }
+        else
+        {
+            stream += (char)126;
+            stream += (char)(size >> 8);
+            stream += (char)size;
+        }
+        stream += payload;
+    }
+
+    printf("%d frames of %zu bytes, %zu byte chunks, %d passes\n", count, size, chunk, iterations);
+    Run<VirtualClient>("virtual OnRecv", stream, chunk, iterations, count);
+    Run<StaticClient<FrameParserOptions> >("BasicWebSocketClient", stream, chunk, iterations, count);
+    Run<StaticClient<BinaryOptions> >("BasicWebSocketClient bin", stream, chunk, iterations, count);
+    return 0;
+}
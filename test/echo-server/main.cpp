@@ -0,0 +1,440 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <string>
+#include <unordered_map>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#ifdef ECHO_SERVER_TLS
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#endif
+
+// Minimal websocket echo server for benchmarks, echoes every data frame back unmasked.
+// A request to "/path?push=<bytes>" is also sent <bytes> of binary frames right after the handshake.
+
+static const char guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+static uint32_t rol(uint32_t x, int n)
+{
+    return (x << n) | (x >> (32 - n));
+}
+
+static void sha1(const unsigned char* data, size_t len, unsigned char out[20])
+{
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    std::string msg((const char*)data, len);
+    msg += (char)0x80;
+    while (msg.size() % 64 != 56)
+        msg += (char)0;
+    uint64_t bits = (uint64_t)len * 8;
+    for (int i = 7; i >= 0; --i)
+        msg += (char)(bits >> (i * 8));
+
+    for (size_t chunk = 0; chunk < msg.size(); chunk += 64)
+    {
+        uint32_t w[80];
+        const unsigned char* p = (const unsigned char*)msg.data() + chunk;
+        for (int i = 0; i < 16; ++i)
+            w[i] = (p[i * 4] << 24) | (p[i * 4 + 1] << 16) | (p[i * 4 + 2] << 8) | p[i * 4 + 3];
+        for (int i = 16; i < 80; ++i)
+            w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; ++i)
+        {
+            uint32_t f, k;
+            if (i < 20) { f = (b & c) | (~b & d); k = 0x5A827999; }
+            else if (i < 40) { f = b ^ c ^ d; k = 0x6ED9EBA1; }
+            else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+            else { f = b ^ c ^ d; k = 0xCA62C1D6; }
+            uint32_t temp = rol(a, 5) + f + e + k + w[i];
+            e = d; d = c; c = rol(b, 30); b = a; a = temp;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+    }
+    for (int i = 0; i < 5; ++i)
+    {
+        out[i * 4] = h[i] >> 24;
+        out[i * 4 + 1] = h[i] >> 16;
+        out[i * 4 + 2] = h[i] >> 8;
+        out[i * 4 + 3] = h[i];
+    }
+}
+
+static std::string base64(const unsigned char* data, size_t len)
+{
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    for (size_t i = 0; i < len; i += 3)
+    {
+        uint32_t n = data[i] << 16;
+        if (i + 1 < len) n |= data[i + 1] << 8;
+        if (i + 2 < len) n |= data[i + 2];
+        out += table[(n >> 18) & 63];
+        out += table[(n >> 12) & 63];
+        out += i + 1 < len ? table[(n >> 6) & 63] : '=';
+        out += i + 2 < len ? table[n & 63] : '=';
+    }
+    return out;
+}
+
+struct Connection
+{
+    Connection() : upgraded(false), closing(false), writing(false), push(0)
+#ifdef ECHO_SERVER_TLS
+        , ssl(NULL)
+#endif
+    {}
+    std::string in;
+    std::string out;
+    bool upgraded;
+    bool closing;   // close after @em out was flushed
+    bool writing;   // watching EPOLLOUT
+    uint64_t push;  // bytes left to push
+#ifdef ECHO_SERVER_TLS
+    SSL* ssl;
+#endif
+};
+
+static std::unordered_map<int, Connection> connections;
+static int epfd;
+static const size_t pushFrameSize = 16 * 1024;
+
+#ifdef ECHO_SERVER_TLS
+static SSL_CTX* sslctx = NULL;
+
+// Map the state of a nonblocking TLS call to errno, like recv()/send() would.
+static ssize_t TlsResult(Connection& conn, int ret)
+{
+    if (ret > 0)
+        return ret;
+    int err = SSL_get_error(conn.ssl, ret);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+    if (err == SSL_ERROR_ZERO_RETURN)
+        return 0;
+    errno = EIO;
+    return -1;
+}
+#endif
+
+static ssize_t ConnRecv(int fd, Connection& conn, char* buf, size_t len)
+{
+#ifdef ECHO_SERVER_TLS
+    if (conn.ssl)
+        return TlsResult(conn, SSL_read(conn.ssl, buf, (int)len));
+#endif
+    return recv(fd, buf, len, 0);
+}
+
+static ssize_t ConnSend(int fd, Connection& conn, const char* buf, size_t len)
+{
+#ifdef ECHO_SERVER_TLS
+    if (conn.ssl)
+        return TlsResult(conn, SSL_write(conn.ssl, buf, (int)len));
+#endif
+    return send(fd, buf, len, MSG_NOSIGNAL);
+}
+
+static void AppendFrame(std::string& out, bool fin, int opcode, const char* data, uint64_t len)
+{
+    out += (char)((fin ? 0x80 : 0) | opcode);
+    if (len <= 125)
+    {
+        out += (char)len;
+    }
+    else if (len <= 0xFFFF)
+    {
+        out += (char)126;
+        out += (char)(len >> 8);
+        out += (char)len;
+    }
+    else
+    {
+        out += (char)127;
+        for (int i = 7; i >= 0; --i)
+            out += (char)(len >> (i * 8));
+    }
+    out.append(data, len);
+}
+
+// Return false if the request is not complete yet.
+static bool Handshake(Connection& conn)
+{
+    size_t end = conn.in.find("\r\n\r\n");
+    if (end == std::string::npos)
+        return false;
+    std::string key;
+    size_t query = conn.in.find("?push=");
+    if (query != std::string::npos && query < conn.in.find("\r\n"))
+        conn.push = strtoull(conn.in.c_str() + query + 6, NULL, 10);
+    size_t pos = 0;
+    while (pos < end)
+    {
+        size_t eol = conn.in.find("\r\n", pos);
+        std::string line = conn.in.substr(pos, eol - pos);
+        if (strncasecmp(line.c_str(), "Sec-WebSocket-Key:", 18) == 0)
+        {
+            key = line.substr(18);
+            key.erase(0, key.find_first_not_of(' '));
+        }
+        pos = eol + 2;
+    }
+    key += guid;
+    unsigned char digest[20];
+    sha1((const unsigned char*)key.data(), key.size(), digest);
+    conn.out += "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                "Sec-WebSocket-Accept: " + base64(digest, sizeof(digest)) + "\r\n\r\n";
+    conn.in.erase(0, end + 4);
+    conn.upgraded = true;
+    return true;
+}
+
+static void ProcessFrames(Connection& conn)
+{
+    size_t pos = 0;
+    for (;;)
+    {
+        size_t avail = conn.in.size() - pos;
+        const unsigned char* p = (const unsigned char*)conn.in.data() + pos;
+        if (avail < 2)
+            break;
+        bool fin = p[0] & 0x80;
+        int opcode = p[0] & 0x0F;
+        bool masked = p[1] & 0x80;
+        uint64_t len = p[1] & 0x7F;
+        size_t header = 2;
+        if (len == 126)
+        {
+            if (avail < 4)
+                break;
+            len = (p[2] << 8) | p[3];
+            header = 4;
+        }
+        else if (len == 127)
+        {
+            if (avail < 10)
+                break;
+            len = 0;
+            for (int i = 0; i < 8; ++i)
+                len = (len << 8) | p[2 + i];
+            header = 10;
+        }
+        const unsigned char* key = p + header;
+        if (masked)
+            header += 4;
+        if (avail < header + len)
+            break;
+
+        char* payload = &conn.in[pos + header];
+        if (masked)
+        {
+            for (uint64_t i = 0; i < len; ++i)
+                payload[i] ^= key[i % 4];
+        }
+
+        if (opcode == 0x8)
+        {
+            AppendFrame(conn.out, true, 0x8, payload, len);
+            conn.closing = true;
+        }
+        else if (opcode == 0x9)
+        {
+            AppendFrame(conn.out, true, 0xA, payload, len);
+        }
+        else if (opcode != 0xA)
+        {
+            AppendFrame(conn.out, fin, opcode, payload, len);
+        }
+        pos += header + len;
+    }
+    conn.in.erase(0, pos);
+}
+
+// Keep up to 256KB of pushed frames queued.
+static void FillPush(Connection& conn)
+{
+    static const std::string payload(pushFrameSize, 'p');
+    while (conn.upgraded && conn.push && conn.out.size() < 256 * 1024)
+    {
+        uint64_t len = conn.push < pushFrameSize ? conn.push : pushFrameSize;
+        AppendFrame(conn.out, true, 0x2, payload.data(), len);
+        conn.push -= len;
+    }
+}
+
+static void CloseConnection(int fd)
+{
+#ifdef ECHO_SERVER_TLS
+    SSL_free(connections[fd].ssl);
+#endif
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+    connections.erase(fd);
+}
+
+// Write as much as possible, watch EPOLLOUT while data is left.
+static void Flush(int fd, Connection& conn)
+{
+    FillPush(conn);
+    while (!conn.out.empty())
+    {
+        ssize_t n = ConnSend(fd, conn, conn.out.data(), conn.out.size());
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            CloseConnection(fd);
+            return;
+        }
+        conn.out.erase(0, n);
+        FillPush(conn);
+    }
+    if (conn.out.empty() && conn.closing)
+    {
+        CloseConnection(fd);
+        return;
+    }
+    if (conn.writing == conn.out.empty())
+    {
+        conn.writing = !conn.out.empty();
+        epoll_event ev;
+        ev.events = EPOLLIN | (conn.writing ? EPOLLOUT : 0);
+        ev.data.fd = fd;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const char* where = argc > 1 ? argv[1] : "8000";
+    int port = atoi(where);
+    bool unixSocket = strchr(where, '/') != NULL;   // a socket path rather than a port
+#ifdef ECHO_SERVER_TLS
+    if (argc > 3)
+    {
+        signal(SIGPIPE, SIG_IGN);   // OpenSSL writes with write(), not send(MSG_NOSIGNAL)
+        sslctx = SSL_CTX_new(TLS_server_method());
+        SSL_CTX_set_options(sslctx, SSL_OP_ENABLE_KTLS);
+        if (SSL_CTX_use_certificate_chain_file(sslctx, argv[2]) != 1 ||
+            SSL_CTX_use_PrivateKey_file(sslctx, argv[3], SSL_FILETYPE_PEM) != 1)
+        {
+            ERR_print_errors_fp(stderr);
+            return 1;
+        }
+    }
+#endif
+
+    int listenfd = socket(unixSocket ? AF_UNIX : AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    int on = 1;
+    int bound;
+    std::string name;
+    if (unixSocket)
+    {
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, where, sizeof(addr.sun_path) - 1);
+        unlink(addr.sun_path);
+        bound = bind(listenfd, (sockaddr*)&addr, sizeof(addr));
+        name = addr.sun_path;
+    }
+    else
+    {
+        setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bound = bind(listenfd, (sockaddr*)&addr, sizeof(addr));
+        name = "127.0.0.1:" + std::to_string(port);
+    }
+    if (bound != 0 || listen(listenfd, 4096) != 0)
+    {
+        perror("listen");
+        return 1;
+    }
+#ifdef ECHO_SERVER_TLS
+    printf("echo server listening on %s%s\n", name.c_str(), sslctx ? " (TLS)" : "");
+#else
+    printf("echo server listening on %s\n", name.c_str());
+#endif
+    fflush(stdout);
+
+    epfd = epoll_create1(0);
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = listenfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev);
+
+    static char buf[256 * 1024];
+    epoll_event events[256];
+    for (;;)
+    {
+        int n = epoll_wait(epfd, events, 256, -1);
+        for (int i = 0; i < n; ++i)
+        {
+            int fd = events[i].data.fd;
+            if (fd == listenfd)
+            {
+                int connfd;
+                while ((connfd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK)) >= 0)
+                {
+                    if (!unixSocket)
+                        setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                    connections[connfd] = Connection();
+#ifdef ECHO_SERVER_TLS
+                    if (sslctx)
+                    {
+                        SSL* ssl = SSL_new(sslctx);
+                        SSL_set_fd(ssl, connfd);
+                        SSL_set_accept_state(ssl);
+                        connections[connfd].ssl = ssl;
+                    }
+#endif
+                    ev.events = EPOLLIN;
+                    ev.data.fd = connfd;
+                    epoll_ctl(epfd, EPOLL_CTL_ADD, connfd, &ev);
+                }
+                continue;
+            }
+
+            auto it = connections.find(fd);
+            if (it == connections.end())
+                continue;
+            Connection& conn = it->second;
+            if (events[i].events & EPOLLIN)
+            {
+                // TLS may hold decrypted data the socket does not signal anymore, read until it would block.
+                ssize_t len;
+                while ((len = ConnRecv(fd, conn, buf, sizeof(buf))) > 0)
+                {
+                    conn.in.append(buf, len);
+                    if (conn.upgraded || Handshake(conn))
+                        ProcessFrames(conn);
+                }
+                if (len == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                {
+                    CloseConnection(fd);
+                    continue;
+                }
+            }
+            Flush(fd, conn);
+        }
+    }
+    return 0;
+}
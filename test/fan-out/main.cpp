@@ -0,0 +1,220 @@
+#include "BasicWebSocketClient.h"
+#include "FanOutRing.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <typeinfo>
+#include <vector>
+using namespace ws;
+
+// One client connected to test/echo-server publishes the echoed frames into a shared-memory ring with
+// SetFanOutRing(), and a few forked consumer processes read them with FanOutReader. Each consumer prints the
+// frames it read and lost, the frames it read twice or not at all, the delay from the dispatch by the client to
+// its reading the frame, and its CPU time per frame. With "basic" the client is a BasicWebSocketClient, which
+// publishes from its own parser.
+
+static uint64_t NowNs()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static int64_t CpuUs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+class Publisher : public WebSocketClientImplCurl
+{
+public:
+    Publisher() : connected(false), failed(false) {}
+    virtual void OnConnect(ConnectResult result) override
+    {
+        if (result == Success)
+            connected = true;
+        else
+            failed = true;
+    }
+    virtual void OnRecv(Message msg, bool fin) override
+    {
+        // Nothing to do here, the frame is in the ring already.
+    }
+
+    std::atomic<bool> connected;
+    std::atomic<bool> failed;
+};
+
+class BasicPublisher : public BasicWebSocketClient<BasicPublisher>
+{
+public:
+    BasicPublisher() : connected(false), failed(false) {}
+    virtual void OnConnect(ConnectResult result) override
+    {
+        if (result == Success)
+            connected = true;
+        else
+            failed = true;
+    }
+    void OnFrame(Message msg, bool fin)
+    {
+    }
+
+    std::atomic<bool> connected;
+    std::atomic<bool> failed;
+};
+
+static int Consume(int id, const char* path, bool spin)
+{
+    FanOutReader reader;
+    if (!reader.Open(path))
+    {
+        printf("consumer %d: cannot open %s\n", id, path);
+        return 1;
+    }
+    std::vector<uint64_t> delays;   // nanoseconds from the dispatch by the client to the read
+    uint64_t sleeps = 0;
+    uint64_t next = 0;          // index the next message should carry
+    uint64_t duplicates = 0;
+    uint64_t missing = 0;
+    bool done = false;
+    int64_t cpu = CpuUs();
+    while (!done)
+    {
+        size_t count = reader.Poll([&](Message msg, bool fin) {
+            if (msg.type == Text && msg.len == 3 && memcmp(msg.data, "end", 3) == 0)
+                done = true;
+            if (msg.type != Binary || msg.len < sizeof(uint64_t))
+                return;
+            uint64_t index;
+            memcpy(&index, msg.data, sizeof(index));
+            if (index < next)
+                ++duplicates;
+            else
+                missing += index - next;
+            next = index + 1;
+            if (msg.dispatchTime)
+                delays.push_back(NowNs() - msg.dispatchTime);
+        });
+        if (count == 0 && !spin)
+        {
+            ++sleeps;
+            reader.Wait(100);
+        }
+    }
+    cpu = CpuUs() - cpu;
+
+    std::sort(delays.begin(), delays.end());
+    if (delays.empty())
+        delays.push_back(0);
+    printf("consumer %d: %8zu frames %6llu lost %6llu twice %6llu missing   delay p50 %7.1f us  p99 %7.1f us   "
+           "cpu %5.2f us/frame  %llu sleeps\n",
+           id, delays.size(), (unsigned long long)reader.Lost(), (unsigned long long)duplicates,
+           (unsigned long long)missing, delays[delays.size() / 2] / 1000.0,
+           delays[delays.size() * 99 / 100] / 1000.0, (double)cpu / delays.size(), (unsigned long long)sleeps);
+    fflush(stdout);     // the child leaves by _exit()
+    // Frames the ring overwrote are missing too, any other gap or repeat is a publishing bug.
+    return duplicates || missing > reader.Lost() ? 1 : 0;
+}
+
+template <class Client>
+static int Publish(const char* url, const char* path, int consumers, int rate, int seconds, bool spin)
+{
+    // The ring exists before the consumers start, and they are forked before the client starts threads.
+    Client client;
+    client.SetTransport(WebSocketClientImplCurl::TransportSocket);
+    client.SetReceiveTimestamps(true);
+    if (!client.SetFanOutRing(path, 4 << 20))
+    {
+        printf("cannot create %s\n", path);
+        return 1;
+    }
+    std::vector<pid_t> children;
+    for (int i = 0; i < consumers; ++i)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+            _exit(Consume(i, path, spin));
+        children.push_back(pid);
+    }
+
+    client.Connect(url);
+    while (!client.connected && !client.failed)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    if (client.failed)
+    {
+        printf("connect failed\n");
+        for (size_t i = 0; i < children.size(); ++i)
+            kill(children[i], SIGTERM);
+        return 1;
+    }
+
+    printf("%s, %s, %d consumers %s, %d msg/s for %d s\n", url, typeid(Client) == typeid(Publisher) ?
+           "WebSocketClientImplCurl" : "BasicWebSocketClient", consumers, spin ? "spinning" : "sleeping when idle",
+           rate, seconds);
+    fflush(stdout);
+    std::string payload(64, 'x');
+    uint64_t sent = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (;;)
+    {
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        if (elapsed >= seconds)
+            break;
+        for (uint64_t due = (uint64_t)(elapsed * rate); sent < due; ++sent)
+        {
+            while (client.SendRemaining() > 0)
+                std::this_thread::yield();
+            memcpy(&payload[0], &sent, sizeof(sent));
+            client.Send(Message(Binary, payload.data(), payload.size()));
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+    while (client.SendRemaining() > 0)
+        std::this_thread::yield();
+    client.Send(Message(Text, "end", 3));
+
+    int failures = 0;
+    for (size_t i = 0; i < children.size(); ++i)
+    {
+        int status;
+        if (waitpid(children[i], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            ++failures;
+    }
+    printf("publisher: %llu frames received over one connection\n",
+           (unsigned long long)client.GetStatistics().framesReceived);
+    client.Close();
+    while (client.GetState() != WebSocketClientImplCurl::Disconnected)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    if (failures)
+        printf("%d consumers saw frames twice or not at all\n", failures);
+    return failures ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char* url = argc > 1 ? argv[1] : "http://127.0.0.1:8000/ws";
+    const char* path = argc > 2 ? argv[2] : "/dev/shm/ws-fan-out";
+    int consumers = argc > 3 ? atoi(argv[3]) : 4;
+    int rate = argc > 4 ? atoi(argv[4]) : 20000;
+    int seconds = argc > 5 ? atoi(argv[5]) : 3;
+    bool spin = false;
+    bool basic = false;
+    for (int i = 6; i < argc; ++i)
+    {
+        spin |= strcmp(argv[i], "spin") == 0;
+        basic |= strcmp(argv[i], "basic") == 0;
+    }
+    if (basic)
+        return Publish<BasicPublisher>(url, path, consumers, rate, seconds, spin);
+    return Publish<Publisher>(url, path, consumers, rate, seconds, spin);
+}
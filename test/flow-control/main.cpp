@@ -0,0 +1,123 @@
+#include "WebSocketClientImplCurl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+using namespace ws;
+
+// A consumer slower than the network: received frames are queued for a worker thread which takes a while for
+// each. Without an inbound budget the queue grows with everything the server pushes; with one, the client stops
+// reading and the server is slowed down by TCP flow control. Run it against test/echo-server.
+
+typedef std::chrono::steady_clock Clock;
+
+class SlowClient : public WebSocketClientImplCurl
+{
+public:
+    SlowClient() : connected(false), failed(false), queued(0), peakQueued(0), consumed(0), stop(false) {}
+    virtual void OnConnect(ConnectResult result) override
+    {
+        if (result == Success)
+            connected = true;
+        else
+            failed = true;
+    }
+    virtual void OnRecv(Message msg, bool fin) override
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        frames.push_back(std::string(msg.data, msg.len));
+        queued += msg.len;
+        if (queued > peakQueued)
+            peakQueued = queued;
+        cond.notify_one();
+    }
+
+    // Worker: spends @em perFrame on each frame, then releases it.
+    void Consume(std::chrono::microseconds perFrame, bool budget)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;)
+        {
+            cond.wait(lock, [this] { return !frames.empty() || stop; });
+            if (frames.empty())
+                return;
+            std::string frame = std::move(frames.front());
+            frames.pop_front();
+            queued -= frame.size();
+            lock.unlock();
+            std::this_thread::sleep_for(perFrame);
+            consumed += frame.size();
+            if (budget)
+                ReleaseInbound(frame.size());
+            lock.lock();
+        }
+    }
+
+    std::atomic<bool> connected;
+    std::atomic<bool> failed;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<std::string> frames;
+    uint64_t queued;
+    uint64_t peakQueued;
+    std::atomic<uint64_t> consumed;
+    bool stop;
+};
+
+static const char* names[] = { "curl", "socket", "io_uring", "io_uring-sqpoll" };
+
+static void Run(const char* url, int transport, uint64_t bytes, uint64_t budget, int perFrameUs)
+{
+    SlowClient client;
+    if (!client.SetTransport((WebSocketClientImplCurl::Transport)transport))
+        return;
+    if (budget)
+        client.SetInboundBudget(budget, 0);
+    std::thread worker(&SlowClient::Consume, &client, std::chrono::microseconds(perFrameUs), budget != 0);
+
+    std::string pushUrl = std::string(url) + "?push=" + std::to_string(bytes);
+    Clock::time_point begin = Clock::now();
+    client.Connect(pushUrl.c_str());
+    while (!client.connected && !client.failed)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    while (client.connected && client.consumed < bytes)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+
+    {
+        std::lock_guard<std::mutex> lock(client.mutex);
+        client.stop = true;
+        client.cond.notify_one();
+    }
+    worker.join();
+    char budgetText[32];
+    snprintf(budgetText, sizeof(budgetText), budget ? "%llu KB" : "none", (unsigned long long)(budget / 1024));
+    printf("%-16s budget %-8s %7.1f MB/s consumed   peak queued %8.1f KB   pauses %llu\n", names[transport],
+           budgetText, bytes / seconds / 1e6, client.peakQueued / 1024.0,
+           (unsigned long long)client.GetStatistics().inboundPauses);
+    client.Close();
+    while (client.GetState() != WebSocketClientImplCurl::Disconnected)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+int main(int argc, char *argv[])
+{
+    const char* url = argc > 1 ? argv[1] : "http://127.0.0.1:8000/ws";
+    uint64_t bytes = argc > 2 ? strtoull(argv[2], NULL, 10) : 64ull * 1024 * 1024;
+    uint64_t budget = argc > 3 ? strtoull(argv[3], NULL, 10) : 1024 * 1024;
+    int perFrameUs = argc > 4 ? atoi(argv[4]) : 100;
+
+    printf("%s, %llu bytes pushed in 16 KB frames, %d us per frame\n", url, (unsigned long long)bytes, perFrameUs);
+    for (int transport = WebSocketClientImplCurl::TransportCurl;
+         transport <= WebSocketClientImplCurl::TransportIoUring; ++transport)
+    {
+        Run(url, transport, bytes, 0, perFrameUs);
+        Run(url, transport, bytes, budget, perFrameUs);
+    }
+    return 0;
+}
@@ -0,0 +1,328 @@
+#include "WebSocketClientImplCurl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+using namespace ws;
+
+// A TCP proxy which impairs the traffic between the client and a server: data is forwarded in chunks of a
+// limited size, each chunk may be delayed, the throughput capped, and the socket buffers of the proxy shrunk.
+// Loopback hardly ever splits frames or fills a socket buffer, through the proxy the client has to parse frames
+// split across reads and finish sends with SendRemaining().
+//
+// "proxy" mode only forwards, "suite" mode runs the regression suite: echo sessions through the proxy for a set
+// of impairments and each transport, checking every echoed message and measuring the throughput.
+
+typedef std::chrono::steady_clock Clock;
+
+struct Impairment
+{
+    const char* name;
+    size_t chunk;       // bytes forwarded per write, 0 for no limit
+    int delayUs;        // pause before each chunk
+    uint64_t rate;      // bytes per second, 0 for no limit
+    int window;         // SO_SNDBUF and SO_RCVBUF of the proxy sockets and SO_SNDBUF of the client, 0 for the
+                        // system default
+    size_t maxMessage;  // largest message the suite sends through it
+};
+
+static void SetWindow(int fd, int window)
+{
+    if (!window)
+        return;
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &window, sizeof(window));
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &window, sizeof(window));
+}
+
+// Forward @em from to @em to until end of stream, impaired by @em imp.
+static void Pump(int from, int to, Impairment imp)
+{
+    std::string buff(imp.chunk ? imp.chunk : 64 * 1024, '\0');
+    Clock::time_point begin = Clock::now();
+    uint64_t forwarded = 0;
+    for (;;)
+    {
+        ssize_t n = recv(from, &buff[0], buff.size(), 0);
+        if (n <= 0)
+            break;
+        for (ssize_t offset = 0; offset < n;)
+        {
+            if (imp.delayUs)
+                std::this_thread::sleep_for(std::chrono::microseconds(imp.delayUs));
+            ssize_t sent = send(to, buff.data() + offset, n - offset, MSG_NOSIGNAL);
+            if (sent <= 0)
+                return;
+            offset += sent;
+            forwarded += sent;
+            if (imp.rate)
+            {
+                Clock::time_point due = begin + std::chrono::microseconds(forwarded * 1000000 / imp.rate);
+                std::this_thread::sleep_until(due);
+            }
+        }
+    }
+    shutdown(to, SHUT_WR);
+}
+
+static void Serve(int client, int upstreamPort, Impairment imp)
+{
+    int server = socket(AF_INET, SOCK_STREAM, 0);
+    SetWindow(server, imp.window);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(upstreamPort);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(server, (sockaddr*)&addr, sizeof(addr)) == 0)
+    {
+        // Every chunk goes out as a segment of its own.
+        int on = 1;
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        setsockopt(server, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        std::thread up(Pump, client, server, imp);
+        Pump(server, client, imp);
+        up.join();
+    }
+    close(server);
+    close(client);
+}
+
+class Proxy
+{
+public:
+    // Listen on an ephemeral port if @em port is 0.
+    Proxy(int port, int upstreamPort, Impairment imp) : m_upstreamPort(upstreamPort), m_imp(imp)
+    {
+        m_listen = socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        setsockopt(m_listen, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        SetWindow(m_listen, imp.window);  // inherited by the accepted sockets
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(m_listen, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(m_listen, 16) != 0)
+            throw "proxy listen failed";
+        socklen_t len = sizeof(addr);
+        getsockname(m_listen, (sockaddr*)&addr, &len);
+        m_port = ntohs(addr.sin_port);
+        m_thread = std::thread(&Proxy::Accept, this);
+    }
+    ~Proxy()
+    {
+        shutdown(m_listen, SHUT_RDWR);
+        m_thread.join();
+        close(m_listen);
+    }
+    int Port() const { return m_port; }
+
+private:
+    void Accept()
+    {
+        for (;;)
+        {
+            int client = accept(m_listen, NULL, NULL);
+            if (client < 0)
+                return;
+            std::thread(Serve, client, m_upstreamPort, m_imp).detach();
+        }
+    }
+
+    int m_listen;
+    int m_port;
+    int m_upstreamPort;
+    Impairment m_imp;
+    std::thread m_thread;
+};
+
+// Content of message @em index, so echoes can be checked without keeping what was sent.
+static void FillMessage(std::string& out, int index, size_t size)
+{
+    out.resize(size);
+    for (size_t j = 0; j < size; ++j)
+        out[j] = (char)(index * 131 + j * 7);
+}
+
+class CheckClient : public WebSocketClientImplCurl
+{
+public:
+    CheckClient() : connected(false), failed(false), received(0), mismatches(0) {}
+    virtual void OnConnect(ConnectResult result) override
+    {
+        if (result == Success)
+            connected = true;
+        else
+            failed = true;
+    }
+    virtual void OnRecv(Message msg, bool fin) override
+    {
+        if (msg.type & 0x8)
+            return;
+        current.append(msg.data, msg.len);
+        if (!fin)
+            return;
+        std::lock_guard<std::mutex> lock(mutex);
+        FillMessage(expected, received, sizes[received % sizes.size()]);
+        if (current != expected)
+            ++mismatches;
+        current.clear();
+        ++received;
+    }
+
+    // Shrink the send buffer of the client socket too, so sends come back unfinished.
+    void SetSendWindow(int* window)
+    {
+        curl_easy_setopt(GetCurlHandle(), CURLOPT_SOCKOPTFUNCTION, SockOptCallback);
+        curl_easy_setopt(GetCurlHandle(), CURLOPT_SOCKOPTDATA, window);
+    }
+    static int SockOptCallback(void* clientp, curl_socket_t fd, curlsocktype purpose)
+    {
+        int window = *(int*)clientp;
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &window, sizeof(window));
+        return CURL_SOCKOPT_OK;
+    }
+
+    std::atomic<bool> connected;
+    std::atomic<bool> failed;
+    std::atomic<int> received;
+    std::atomic<int> mismatches;
+    std::mutex mutex;
+    std::vector<size_t> sizes;
+    std::string current;    // message being reassembled from its fragments
+    std::string expected;
+};
+
+static const char* names[] = { "curl", "socket", "io_uring", "io_uring-sqpoll" };
+
+// Return false if an echo did not match.
+static bool RunCase(int upstreamPort, const Impairment& imp, int transport, size_t maxFrameSize, int count)
+{
+    static const size_t allSizes[] = { 1, 125, 126, 127, 1000, 65535, 65536, 65537, 300000, 17 };
+    Proxy proxy(0, upstreamPort, imp);
+    int window = imp.window;
+    char url[64];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/ws", proxy.Port());
+
+    CheckClient client;
+    if (!client.SetTransport((WebSocketClientImplCurl::Transport)transport))
+        return true;
+    client.SetMaxFrameSize(maxFrameSize);
+    if (window)
+        client.SetSendWindow(&window);
+    for (size_t i = 0; i < sizeof(allSizes) / sizeof(allSizes[0]); ++i)
+    {
+        if (allSizes[i] <= imp.maxMessage)
+            client.sizes.push_back(allSizes[i]);
+    }
+    client.Connect(url);
+    while (!client.connected && !client.failed)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    if (client.failed)
+    {
+        printf("%-22s %-16s connect failed\n", imp.name, names[transport]);
+        return false;
+    }
+
+    // At most 4 messages in flight, the proxy may be slower than the client.
+    std::string payload;
+    uint64_t bytes = 0;
+    int partial = 0;
+    Clock::time_point begin = Clock::now();
+    for (int i = 0; i < count; ++i)
+    {
+        while (i - client.received >= 4 && client.connected)
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        size_t size = client.sizes[i % client.sizes.size()];
+        FillMessage(payload, i, size);
+        int64_t remaining = client.Send(Message(Binary, payload.data(), payload.size()));
+        if (remaining > 0)
+            ++partial;
+        while (remaining > 0)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+            remaining = client.SendRemaining();
+        }
+        if (remaining < 0)
+            break;
+        bytes += size;
+    }
+    Clock::time_point deadline = Clock::now() + std::chrono::seconds(60);
+    while (client.received < count && Clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+
+    bool ok = client.received == count && client.mismatches == 0;
+    char frames[16];
+    snprintf(frames, sizeof(frames), maxFrameSize ? "%zu" : "-", maxFrameSize);
+    printf("%-22s %-16s frag %-6s %8.2f MB/s   partial sends %4d/%-4d   echoes %4d/%-4d  %s\n", imp.name,
+           names[transport], frames, 2.0 * bytes / seconds / 1e6, partial, count, client.received - client.mismatches,
+           count, ok ? "ok" : "FAILED");
+
+    client.Close();
+    while (client.GetState() != WebSocketClientImplCurl::Disconnected)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    return ok;
+}
+
+static int RunSuite(int upstreamPort, int count)
+{
+    static const Impairment cases[] = {
+        { "passthrough", 0, 0, 0, 0, 1 << 30 },
+        { "1-byte chunks", 1, 0, 0, 0, 2000 },
+        { "7-byte chunks", 7, 0, 0, 0, 70000 },
+        { "1460-byte chunks 50us", 1460, 50, 0, 0, 1 << 30 },
+        { "4 KB window 4 MB/s", 0, 0, 4 * 1024 * 1024, 4096, 1 << 30 },
+        { "16 KB window 32 MB/s", 4096, 0, 32 * 1024 * 1024, 16384, 1 << 30 },
+    };
+    int failures = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i)
+    {
+        for (int transport = WebSocketClientImplCurl::TransportCurl;
+             transport <= WebSocketClientImplCurl::TransportIoUring; ++transport)
+        {
+            if (!RunCase(upstreamPort, cases[i], transport, 0, count))
+                ++failures;
+        }
+        // Fragmented messages through the same impairment.
+        if (!RunCase(upstreamPort, cases[i], WebSocketClientImplCurl::TransportSocket, 4000, count))
+            ++failures;
+    }
+    printf(failures ? "%d cases FAILED\n" : "all cases passed\n", failures);
+    return failures ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc >= 3 && strcmp(argv[1], "suite") == 0)
+        return RunSuite(atoi(argv[2]), argc > 3 ? atoi(argv[3]) : 40);
+
+    if (argc >= 4 && strcmp(argv[1], "proxy") == 0)
+    {
+        Impairment imp = { "proxy", 0, 0, 0, 0, 0 };
+        imp.chunk = argc > 4 ? atoi(argv[4]) : 0;
+        imp.delayUs = argc > 5 ? atoi(argv[5]) : 0;
+        imp.rate = argc > 6 ? strtoull(argv[6], NULL, 10) : 0;
+        imp.window = argc > 7 ? atoi(argv[7]) : 0;
+        Proxy proxy(atoi(argv[2]), atoi(argv[3]), imp);
+        printf("forwarding 127.0.0.1:%d to port %s, chunk %zu, delay %d us, rate %llu B/s, window %d\n", proxy.Port(),
+               argv[3], imp.chunk, imp.delayUs, (unsigned long long)imp.rate, imp.window);
+        for (;;)
+            pause();
+    }
+
+    printf("usage: %s suite <server port> [messages per case]\n"
+           "       %s proxy <listen port> <server port> [chunk] [delay us] [bytes/s] [window]\n", argv[0], argv[0]);
+    return 1;
+}
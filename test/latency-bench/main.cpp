@@ -0,0 +1,104 @@
+#include "WebSocketClientImplCurl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace ws;
+
+// Ping-pong latency of the default receive loop versus busy polling, run it against test/echo-server.
+// One message is in flight at a time, the round trip is measured from Send() to OnRecv() of the echo.
+
+typedef std::chrono::steady_clock Clock;
+
+class PingClient : public WebSocketClientImplCurl
+{
+public:
+    PingClient() : connected(false), failed(false), received(0) {}
+    virtual void OnConnect(ConnectResult result) override
+    {
+        if (result == Success)
+            connected = true;
+        else
+            failed = true;
+    }
+    virtual void OnRecv(Message msg, bool fin) override
+    {
+        if (fin)
+        {
+            arrival = Clock::now();
+            ++received;
+        }
+    }
+
+    std::atomic<bool> connected;
+    std::atomic<bool> failed;
+    std::atomic<int> received;
+    Clock::time_point arrival;
+};
+
+static void Run(const char* label, const char* url, WebSocketClientImplCurl::Transport transport, bool busyPoll,
+                int cpu, unsigned socketBusyPollUs, size_t size, int count)
+{
+    PingClient client;
+    client.SetTransport(transport);
+    if (busyPoll && !client.SetBusyPoll(true, cpu, socketBusyPollUs))
+    {
+        printf("%-24s not supported on this platform\n", label);
+        return;
+    }
+    client.Connect(url);
+    while (!client.connected && !client.failed)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    if (client.failed)
+    {
+        printf("%-24s connect failed\n", label);
+        return;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    int base = client.received;
+
+    std::string payload(size, 'x');
+    std::vector<double> rtts;
+    rtts.reserve(count);
+    for (int i = 0; i < count; ++i)
+    {
+        Clock::time_point begin = Clock::now();
+        int64_t remaining = client.Send(Message(Binary, payload.data(), payload.size()));
+        while (remaining > 0)
+            remaining = client.SendRemaining();
+        while (client.received < base + i + 1)
+            std::this_thread::yield();
+        rtts.push_back(std::chrono::duration<double, std::micro>(client.arrival - begin).count());
+    }
+    std::sort(rtts.begin(), rtts.end());
+    printf("%-24s p50 %7.1f us   p99 %7.1f us   p99.9 %7.1f us   max %8.1f us\n", label,
+           rtts[rtts.size() / 2], rtts[(size_t)(rtts.size() * 0.99)], rtts[(size_t)(rtts.size() * 0.999)],
+           rtts.back());
+
+    client.Close();
+    while (client.GetState() != WebSocketClientImplCurl::Disconnected)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+int main(int argc, char *argv[])
+{
+    const char* url = argc > 1 ? argv[1] : "http://127.0.0.1:8000/ws";
+    size_t size = argc > 2 ? atoi(argv[2]) : 64;
+    int count = argc > 3 ? atoi(argv[3]) : 100000;
+    int cpu = argc > 4 ? atoi(argv[4]) : -1;
+    unsigned socketBusyPollUs = argc > 5 ? atoi(argv[5]) : 0;
+
+    printf("%s, %zu bytes per message, %d round trips, busy poll on cpu %d, SO_BUSY_POLL %u us\n", url, size, count,
+           cpu, socketBusyPollUs);
+    if (std::thread::hardware_concurrency() < 3)
+        printf("note: %u CPUs, the spinning thread competes with the server and the caller\n",
+               std::thread::hardware_concurrency());
+    Run("socket", url, WebSocketClientImplCurl::TransportSocket, false, -1, 0, size, count);
+    Run("io_uring", url, WebSocketClientImplCurl::TransportIoUring, false, -1, 0, size, count);
+    Run("socket busy-poll", url, WebSocketClientImplCurl::TransportSocket, true, cpu, socketBusyPollUs, size, count);
+    return 0;
+}
@@ -0,0 +1,200 @@
+#include "WebSocketClientImplCurl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+#include <unistd.h>
+using namespace ws;
+
+// Load generator: opens many connections at a target rate, holds them with some echo traffic, and reports
+// connect rate, handshake latency, memory per connection and CPU per message. Run it against test/echo-server.
+
+typedef std::chrono::steady_clock Clock;
+
+static std::atomic<uint64_t> repliesReceived(0);
+
+class LoadClient : public WebSocketClientImplCurl
+{
+public:
+    LoadClient() : connected(false), failed(false) {}
+    virtual void OnConnect(ConnectResult result) override
+    {
+        if (result == Success)
+        {
+            handshake = Clock::now() - started;
+            connected = true;
+        }
+        else
+        {
+            failed = true;
+        }
+    }
+    virtual void OnRecv(Message msg, bool fin) override
+    {
+        if (fin)
+            ++repliesReceived;
+    }
+
+    Clock::time_point started;
+    Clock::duration handshake;
+    std::atomic<bool> connected;
+    std::atomic<bool> failed;
+};
+
+// resident set size in bytes
+static uint64_t Rss()
+{
+    unsigned long pages = 0, resident = 0;
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (f)
+    {
+        if (fscanf(f, "%lu %lu", &pages, &resident) != 2)
+            resident = 0;
+        fclose(f);
+    }
+    return (uint64_t)resident * sysconf(_SC_PAGESIZE);
+}
+
+// user + system CPU time of the process in seconds
+static double CpuSeconds()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static double Ms(Clock::duration d)
+{
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        printf("usage: %s <url> [connections] [connects/s] [hold seconds] [messages/s per connection] "
+               "[message bytes] [transport] [idle timeout ms]\n", argv[0]);
+        return 1;
+    }
+    const char* url = argv[1];
+    int count = argc > 2 ? atoi(argv[2]) : 1000;
+    double rate = argc > 3 ? atof(argv[3]) : 500;
+    double hold = argc > 4 ? atof(argv[4]) : 10;
+    double msgRate = argc > 5 ? atof(argv[5]) : 1;
+    size_t size = argc > 6 ? atoi(argv[6]) : 64;
+    int transport = argc > 7 ? atoi(argv[7]) : WebSocketClientImplCurl::TransportSocket;
+    unsigned idleTimeout = argc > 8 ? atoi(argv[8]) : 0;
+
+    // Every connection needs a descriptor.
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    printf("%s: %d connections at %.0f/s, held %.0f s with %.1f messages/s of %zu bytes each\n", url, count, rate,
+           hold, msgRate, size);
+    uint64_t rssBefore = Rss();
+
+    // Connect phase.
+    std::vector<LoadClient*> clients;
+    clients.reserve(count);
+    Clock::time_point begin = Clock::now();
+    for (int i = 0; i < count; ++i)
+    {
+        Clock::time_point due = begin + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(i / rate));
+        std::this_thread::sleep_until(due);
+        LoadClient* client = new LoadClient;
+        client->SetTransport((WebSocketClientImplCurl::Transport)transport);
+        client->SetIdleTimeout(idleTimeout);
+        client->started = Clock::now();
+        client->Connect(url);
+        clients.push_back(client);
+    }
+    std::vector<double> handshakes;
+    int failed = 0;
+    for (LoadClient* client : clients)
+    {
+        while (!client->connected && !client->failed)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        if (client->connected)
+            handshakes.push_back(Ms(client->handshake));
+        else
+            ++failed;
+    }
+    double connectSeconds = std::chrono::duration<double>(Clock::now() - begin).count();
+    uint64_t rssConnected = Rss();
+
+    std::sort(handshakes.begin(), handshakes.end());
+    printf("connected %zu, failed %d in %.2f s: %.0f connects/s\n", handshakes.size(), failed, connectSeconds,
+           handshakes.size() / connectSeconds);
+    if (!handshakes.empty())
+    {
+        size_t n = handshakes.size();
+        printf("handshake latency  p50 %.2f ms  p90 %.2f ms  p99 %.2f ms  max %.2f ms\n", handshakes[n / 2],
+               handshakes[n * 90 / 100], handshakes[n * 99 / 100], handshakes[n - 1]);
+        printf("memory             %.1f KB RSS per connection\n", (double)(rssConnected - rssBefore) / n / 1024);
+    }
+
+    // Hold phase: every connection sends msgRate messages per second, the server echoes them back.
+    std::string payload(size, 'l');
+    uint64_t sent = 0;
+    double cpuBefore = CpuSeconds();
+    begin = Clock::now();
+    Clock::time_point end = begin + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(hold));
+    double interval = msgRate > 0 ? 1.0 / (msgRate * clients.size()) : hold;
+    for (uint64_t tick = 0; ; ++tick)
+    {
+        Clock::time_point due = begin + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(tick * interval));
+        if (due >= end)
+            break;
+        std::this_thread::sleep_until(due);
+        if (msgRate <= 0)
+            continue;
+        LoadClient* client = clients[tick % clients.size()];
+        if (!client->connected || client->GetState() != WebSocketClientImplCurl::Connected)
+            continue;
+        int64_t remaining = client->Send(Message(Binary, payload.data(), payload.size()));
+        while (remaining > 0)
+            remaining = client->SendRemaining();
+        if (remaining == 0)
+            ++sent;
+    }
+    std::this_thread::sleep_until(end);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));    // let the last replies arrive
+    double cpu = CpuSeconds() - cpuBefore;
+    uint64_t received = repliesReceived;
+    printf("traffic            %llu sent, %llu echoed, %.1f us CPU per message (sent or received)\n",
+           (unsigned long long)sent, (unsigned long long)received,
+           sent + received ? cpu * 1e6 / (sent + received) : 0.0);
+    printf("memory             %.1f KB RSS per connection after traffic\n",
+           handshakes.empty() ? 0.0 : (double)(Rss() - rssBefore) / handshakes.size() / 1024);
+
+    if (idleTimeout && !handshakes.empty())
+    {
+        // Let every connection hibernate.
+        std::this_thread::sleep_for(std::chrono::milliseconds(idleTimeout + 1000));
+        uint64_t hibernations = 0;
+        for (LoadClient* client : clients)
+            hibernations += client->GetStatistics().hibernations;
+        printf("memory             %.1f KB RSS per connection after %u ms idle (%llu hibernations)\n",
+               (double)(Rss() - rssBefore) / handshakes.size() / 1024, idleTimeout, (unsigned long long)hibernations);
+    }
+
+    for (LoadClient* client : clients)
+        client->Close();
+    for (LoadClient* client : clients)
+    {
+        while (client->GetState() != WebSocketClientImplCurl::Disconnected)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        delete client;
+    }
+    return 0;
+}
@@ -0,0 +1,134 @@
+#include "WebSocketClientImplCurl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace ws;
+
+// Measures how long received frames wait inside the library: the time from the kernel timestamp of the data to
+// the call of OnRecv(). Messages are echoed by test/echo-server in bursts, and the handler spends a fixed time
+// on each frame, so the later frames of a chunk queue behind the earlier ones.
+
+class StampClient : public WebSocketClientImplCurl
+{
+public:
+    StampClient(int workUs) : connected(false), failed(false), received(0), unstamped(0), workUs(workUs) {}
+    virtual void OnConnect(ConnectResult result) override
+    {
+        if (result == Success)
+            connected = true;
+        else
+            failed = true;
+    }
+    virtual void OnRecv(Message msg, bool fin) override
+    {
+        if (msg.kernelTime)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            delays.push_back(msg.dispatchTime - msg.kernelTime);
+        }
+        else
+        {
+            ++unstamped;
+        }
+        // Simulated handler work.
+        std::chrono::steady_clock::time_point end =
+            std::chrono::steady_clock::now() + std::chrono::microseconds(workUs);
+        while (std::chrono::steady_clock::now() < end)
+            ;
+        ++received;
+    }
+
+    std::atomic<bool> connected;
+    std::atomic<bool> failed;
+    std::atomic<int> received;
+    std::atomic<int> unstamped;
+    std::mutex mutex;
+    std::vector<uint64_t> delays;   // nanoseconds
+    int workUs;
+};
+
+static const char* names[] = { "curl", "socket", "io_uring", "io_uring-sqpoll" };
+
+static double Percentile(const std::vector<uint64_t>& sorted, double p)
+{
+    return sorted[(size_t)((sorted.size() - 1) * p)] / 1000.0;
+}
+
+static void Run(const char* url, int transport, size_t size, int count, int burst, int workUs)
+{
+    StampClient client(workUs);
+    if (!client.SetTransport((WebSocketClientImplCurl::Transport)transport))
+        return;
+    if (!client.SetReceiveTimestamps(true))
+    {
+        printf("receive timestamps are not supported on this platform\n");
+        exit(1);
+    }
+    client.Connect(url);
+    while (!client.connected && !client.failed)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    if (client.failed)
+    {
+        printf("%-16s connect failed\n", names[transport]);
+        return;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    client.received = 0;
+
+    std::string payload(size, 'x');
+    for (int sent = 0; sent < count; sent += burst)
+    {
+        for (int i = 0; i < burst; ++i)
+        {
+            int64_t remaining = client.Send(Message(Binary, payload.data(), payload.size()));
+            while (remaining > 0)
+                remaining = client.SendRemaining();
+        }
+        while (client.received < sent + burst)
+            std::this_thread::yield();
+    }
+
+    std::vector<uint64_t> delays;
+    {
+        std::lock_guard<std::mutex> lock(client.mutex);
+        delays.swap(client.delays);
+    }
+    if (delays.empty())
+    {
+        printf("%-16s no kernel timestamps (%d frames)\n", names[transport], (int)client.unstamped);
+    }
+    else
+    {
+        std::sort(delays.begin(), delays.end());
+        printf("%-16s kernel to OnRecv: p50 %8.1f us   p99 %8.1f us   max %8.1f us   (%zu frames)\n",
+               names[transport], Percentile(delays, 0.5), Percentile(delays, 0.99), Percentile(delays, 1.0),
+               delays.size());
+    }
+    client.Close();
+    while (client.GetState() != WebSocketClientImplCurl::Disconnected)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+int main(int argc, char *argv[])
+{
+    const char* url = argc > 1 ? argv[1] : "http://127.0.0.1:8000/ws";
+    size_t size = argc > 2 ? atoi(argv[2]) : 64;
+    int count = argc > 3 ? atoi(argv[3]) : 20000;
+    int burst = argc > 4 ? atoi(argv[4]) : 16;
+    int workUs = argc > 5 ? atoi(argv[5]) : 5;
+
+    printf("%s, %zu bytes per message, %d messages in bursts of %d, %d us of work per frame\n", url, size, count,
+           burst, workUs);
+    for (int transport = WebSocketClientImplCurl::TransportCurl;
+         transport <= WebSocketClientImplCurl::TransportIoUring; ++transport)
+    {
+        Run(url, transport, size, count, burst, workUs);
+    }
+    return 0;
+}
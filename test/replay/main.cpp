@@ -0,0 +1,88 @@
+#include "WebSocketClientImplCurl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+using namespace ws;
+
+static const char magic[] = "WSCAP001";
+
+// Counts what the parser delivers, without doing anything else per frame.
+class ReplayClient : public WebSocketClientImplCurl
+{
+public:
+    ReplayClient() : frames(0), payload(0) {}
+    virtual void OnRecv(Message msg, bool fin) override
+    {
+        ++frames;
+        payload += msg.len;
+    }
+    void Feed(const char* data, size_t len)
+    {
+        ParseInbound(data, len);
+    }
+
+    uint64_t frames;
+    uint64_t payload;
+};
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        printf("usage: %s <capture file> [iterations]\n", argv[0]);
+        return 1;
+    }
+    int iterations = argc > 2 ? atoi(argv[2]) : 100;
+
+    int fd = open(argv[1], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < (off_t)(sizeof(magic) - 1))
+    {
+        printf("cannot open %s\n", argv[1]);
+        return 1;
+    }
+    const char* base = (const char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED || memcmp(base, magic, sizeof(magic) - 1) != 0)
+    {
+        printf("%s is not a capture file\n", argv[1]);
+        return 1;
+    }
+    const char* end = base + st.st_size;
+
+    ReplayClient client;
+    uint64_t chunks = 0;
+    uint64_t wire = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+    {
+        const char* p = base + sizeof(magic) - 1;
+        while (end - p >= 4)
+        {
+            const unsigned char* size = (const unsigned char*)p;
+            size_t len = ((size_t)size[0] << 24) | ((size_t)size[1] << 16) | ((size_t)size[2] << 8) | size[3];
+            p += 4;
+            if ((size_t)(end - p) < len)
+                break;  // truncated record
+            client.Feed(p, len);
+            p += len;
+            ++chunks;
+            wire += len;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    printf("iterations: %d, chunks: %llu, frames: %llu\n", iterations,
+           (unsigned long long)chunks, (unsigned long long)client.frames);
+    printf("wire bytes: %llu, payload bytes: %llu, time: %.3f s\n",
+           (unsigned long long)wire, (unsigned long long)client.payload, seconds);
+    printf("%.0f frames/s, %.1f MB/s\n", client.frames / seconds, wire / seconds / 1e6);
+
+    munmap((void*)base, st.st_size);
+    return 0;
+}
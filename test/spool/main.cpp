@@ -0,0 +1,195 @@
+#include "WebSocketClientImplCurl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unistd.h>
+using namespace ws;
+
+// SetSpoolFile(): the cost of sending through the spool compared with the in-memory path, and the replay of
+// spooled messages across a restart and a reconnect. Run it against test/echo-server.
+
+class SpoolClient : public WebSocketClientImplCurl
+{
+public:
+    SpoolClient() : connected(false), failed(false), received(0), outOfOrder(0) {}
+    virtual void OnConnect(ConnectResult result) override
+    {
+        if (result == Success)
+            connected = true;
+        else
+            failed = true;
+    }
+    virtual void OnRecv(Message msg, bool fin) override
+    {
+        if (msg.type != Binary)
+            return;
+        uint64_t seq = 0;
+        if (msg.len >= sizeof(seq))
+            memcpy(&seq, msg.data, sizeof(seq));
+        if (seq != (uint64_t)received % expectedCycle)
+            ++outOfOrder;
+        ++received;
+    }
+
+    bool Open(const char* url)
+    {
+        connected = false;
+        failed = false;
+        Connect(url);
+        while (!connected && !failed)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return connected;
+    }
+
+    void Shut()
+    {
+        Close();
+        while (GetState() != Disconnected)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    std::atomic<bool> connected;
+    std::atomic<bool> failed;
+    std::atomic<int> received;
+    std::atomic<int> outOfOrder;
+    int expectedCycle = 1 << 30;    // messages carry their sequence number, which restarts after a replay
+};
+
+static double ThreadCpuSeconds()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void Bench(const char* url, const char* path, size_t size, int count, bool spool)
+{
+    SpoolClient client;
+    client.SetTransport(WebSocketClientImplCurl::TransportSocket);
+    unlink(path);
+    if (spool && !client.SetSpoolFile(path, 64 << 20))
+    {
+        printf("cannot create %s\n", path);
+        exit(1);
+    }
+    if (!client.Open(url))
+    {
+        printf("connect failed\n");
+        exit(1);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    std::string payload(size, 'x');
+    auto begin = std::chrono::steady_clock::now();
+    double cpu = ThreadCpuSeconds();
+    int sent = 0;
+    while (sent < count)
+    {
+        // Up to 8 messages in flight. The in-memory path takes a message once the last one is sent, the spool
+        // takes it at once.
+        if (sent - client.received >= 8 || (!spool && client.SendRemaining() > 0))
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        memcpy(&payload[0], &sent, sizeof(sent));
+        if (client.Send(Message(Binary, payload.data(), payload.size())) < 0)
+            client.SendRemaining();     // spool full
+        else
+            ++sent;
+    }
+    while (client.SendRemaining() > 0)
+        std::this_thread::yield();
+    cpu = ThreadCpuSeconds() - cpu;
+    while (client.received < count)
+        std::this_thread::yield();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    printf("%-10s %8.1f MB/s echo   %6.2f us sender CPU per message\n", spool ? "spool" : "in memory",
+           2.0 * count * size / seconds / 1e6, cpu / count * 1e6);
+    client.Shut();
+    unlink(path);
+}
+
+static bool Check(const char* what, bool ok)
+{
+    printf("%-56s %s\n", what, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+static int Replay(const char* url, const char* path, int count)
+{
+    std::string payload(1000, 'x');
+    bool ok = true;
+    unlink(path);
+    {
+        // Spooled while the server is out of reach, then the process "restarts".
+        SpoolClient client;
+        client.SetSpoolFile(path, 16 << 20, true);
+        int taken = 0;
+        for (uint64_t seq = 0; seq < (uint64_t)count; ++seq)
+        {
+            memcpy(&payload[0], &seq, sizeof(seq));
+            if (client.Send(Message(Binary, payload.data(), payload.size())) > 0)
+                ++taken;
+        }
+        ok &= Check("messages spooled while disconnected", taken == count);
+    }
+    {
+        SpoolClient client;
+        client.SetTransport(WebSocketClientImplCurl::TransportSocket);
+        client.expectedCycle = count;
+        ok &= Check("spool reopened", client.SetSpoolFile(path, 16 << 20, true));
+        ok &= Check("connected", client.Open(url));
+        while (client.SendRemaining() > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        for (int i = 0; i < 5000 && client.received < count; ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        ok &= Check("spooled messages sent after the restart, in order", client.received == count && !client.outOfOrder);
+
+        // Not acknowledged, so a new connection sends them again.
+        client.Shut();
+        ok &= Check("connected again", client.Open(url));
+        while (client.SendRemaining() > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        for (int i = 0; i < 5000 && client.received < 2 * count; ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        ok &= Check("unacknowledged messages sent again on reconnect", client.received == 2 * count &&
+                    !client.outOfOrder);
+        client.AcknowledgeSpool(client.GetSpoolOffset());
+        client.Shut();
+    }
+    {
+        SpoolClient client;
+        client.SetTransport(WebSocketClientImplCurl::TransportSocket);
+        client.SetSpoolFile(path, 16 << 20, true);
+        ok &= Check("connected after acknowledging", client.Open(url));
+        int64_t remaining = client.SendRemaining();
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        ok &= Check("nothing sent again once acknowledged", remaining == 0 && client.received == 0);
+        client.Shut();
+    }
+    unlink(path);
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+    const char* mode = argc > 1 ? argv[1] : "bench";
+    const char* url = argc > 2 ? argv[2] : "http://127.0.0.1:8000/ws";
+    const char* path = argc > 3 ? argv[3] : "/tmp/ws-spool";
+    if (strcmp(mode, "replay") == 0)
+        return Replay(url, path, argc > 4 ? atoi(argv[4]) : 1000);
+
+    size_t size = argc > 4 ? atoi(argv[4]) : 1024;
+    int count = argc > 5 ? atoi(argv[5]) : 200000;
+    printf("%s, %d messages of %zu bytes\n", url, count, size);
+    Bench(url, path, size, count, false);
+    Bench(url, path, size, count, true);
+    return 0;
+}
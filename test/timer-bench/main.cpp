@@ -0,0 +1,139 @@
+#include "TimerWheel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <map>
+#include <random>
+#include <vector>
+using namespace ws;
+
+// Cost of the connection timers at scale: the timer wheel the clients use, against an ordered map. Every
+// simulated connection has a ping timer and a receive timeout, as with SetPingInterval() and SetReceiveTimeout().
+
+static double Seconds(std::chrono::steady_clock::time_point begin)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+struct WheelTimers
+{
+    static const char* Name() { return "timer wheel"; }
+
+    struct Timer
+    {
+        TimerNode node;
+    };
+
+    TimerWheel wheel;
+    void Schedule(Timer& timer, uint64_t expires) { wheel.Schedule(&timer.node, expires); }
+    void Cancel(Timer& timer) { wheel.Cancel(&timer.node); }
+    template <class F>
+    size_t Advance(uint64_t now, F&& fire)
+    {
+        return wheel.Advance(now, [&](TimerNode* node) { fire(*(Timer*)node); });
+    }
+};
+
+struct MapTimers
+{
+    static const char* Name() { return "std::multimap"; }
+
+    struct Timer
+    {
+        std::multimap<uint64_t, Timer*>::iterator it;
+        bool armed = false;
+    };
+
+    std::multimap<uint64_t, Timer*> map;
+    uint64_t now = 0;
+    void Schedule(Timer& timer, uint64_t expires)
+    {
+        Cancel(timer);
+        timer.it = map.insert(std::make_pair(expires, &timer));
+        timer.armed = true;
+    }
+    void Cancel(Timer& timer)
+    {
+        if (timer.armed)
+            map.erase(timer.it);
+        timer.armed = false;
+    }
+    template <class F>
+    size_t Advance(uint64_t tick, F&& fire)
+    {
+        size_t fired = 0;
+        now = tick;
+        while (!map.empty() && map.begin()->first <= now)
+        {
+            Timer* timer = map.begin()->second;
+            map.erase(map.begin());
+            timer->armed = false;
+            fire(*timer);
+            ++fired;
+        }
+        return fired;
+    }
+};
+
+template <class Timers>
+static void Run(int connections, unsigned pingMs, unsigned receiveMs, unsigned seconds)
+{
+    typedef typename Timers::Timer Timer;
+    Timers timers;
+    std::vector<Timer> pings(connections);
+    std::vector<Timer> receives(connections);
+    std::minstd_rand random(1);
+
+    // Arm: connections established over one ping interval.
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < connections; ++i)
+    {
+        timers.Schedule(pings[i], random() % pingMs + 1);
+        timers.Schedule(receives[i], receiveMs + random() % pingMs);
+    }
+    double arm = Seconds(begin);
+
+    // Run: each ping is re-armed; a pong arrives for it, so the receive timeout is found quiet for less than its
+    // time and re-armed too, which is what the clients do instead of moving it on every inbound chunk.
+    Timer* ping0 = &pings[0];
+    Timer* ping1 = ping0 + connections;
+    uint64_t fired = 0;
+    begin = std::chrono::steady_clock::now();
+    for (uint64_t tick = 1; tick <= (uint64_t)seconds * 1000; ++tick)
+    {
+        fired += timers.Advance(tick, [&](Timer& timer) {
+            if (&timer >= ping0 && &timer < ping1)
+                timers.Schedule(timer, tick + pingMs);
+            else
+                timers.Schedule(timer, tick + receiveMs - pingMs / 2);
+        });
+    }
+    double run = Seconds(begin);
+
+    // Cancel: the connections close.
+    begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < connections; ++i)
+    {
+        timers.Cancel(pings[i]);
+        timers.Cancel(receives[i]);
+    }
+    double cancel = Seconds(begin);
+
+    printf("%-14s arm %6.1f ns  cancel %6.1f ns  expire+re-arm %6.1f ns   %8llu expiries, %5.2f%% of a core\n",
+           Timers::Name(), arm / (2.0 * connections) * 1e9, cancel / (2.0 * connections) * 1e9, run / fired * 1e9,
+           (unsigned long long)fired, run / seconds * 100);
+}
+
+int main(int argc, char *argv[])
+{
+    int connections = argc > 1 ? atoi(argv[1]) : 50000;
+    unsigned pingMs = argc > 2 ? atoi(argv[2]) : 1000;
+    unsigned receiveMs = argc > 3 ? atoi(argv[3]) : 3000;
+    unsigned seconds = argc > 4 ? atoi(argv[4]) : 60;
+
+    printf("%d connections, ping every %u ms, receive timeout %u ms, %u s simulated\n", connections, pingMs,
+           receiveMs, seconds);
+    Run<WheelTimers>(connections, pingMs, receiveMs, seconds);
+    Run<MapTimers>(connections, pingMs, receiveMs, seconds);
+    return 0;
+}
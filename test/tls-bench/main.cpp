@@ -0,0 +1,182 @@
+#include "WebSocketClientImplCurl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+using namespace ws;
+
+// TLS benchmark: handshake time with and without session resumption, and receive throughput with and
+// without kTLS. Run it against test/echo-server built with ECHO_SERVER_TLS. Checks first that Close()
+// ends a wss:// connection promptly, and that a plain connection is not reported as TLS.
+
+class BenchClient : public WebSocketClientImplCurl
+{
+public:
+    BenchClient() : connected(false), failed(false), received(0)
+    {
+        // the test certificate is self-signed
+        curl_easy_setopt(GetCurlHandle(), CURLOPT_SSL_VERIFYPEER, 0L);
+        curl_easy_setopt(GetCurlHandle(), CURLOPT_SSL_VERIFYHOST, 0L);
+    }
+    virtual void OnConnect(ConnectResult result) override
+    {
+        if (result == Success)
+            connected = true;
+        else
+            failed = true;
+    }
+    virtual void OnRecv(Message msg, bool fin) override
+    {
+        received += msg.len;
+    }
+
+    double AppConnectTime()
+    {
+        double seconds = 0;
+        curl_easy_getinfo(GetCurlHandle(), CURLINFO_APPCONNECT_TIME, &seconds);
+        return seconds;
+    }
+
+    std::atomic<bool> connected;
+    std::atomic<bool> failed;
+    std::atomic<uint64_t> received;
+};
+
+static bool WaitConnected(BenchClient& client)
+{
+    while (!client.connected && !client.failed)
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    return client.connected;
+}
+
+static void Handshakes(const char* url, bool sharing, int count)
+{
+    double total = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        BenchClient client;
+        client.SetTlsSessionSharing(sharing);
+        client.Connect(url);
+        if (!WaitConnected(client))
+        {
+            printf("connect failed\n");
+            return;
+        }
+        // the first connection of the shared cache has nothing to resume
+        if (i > 0 || !sharing)
+            total += client.AppConnectTime();
+        client.Close();
+        while (client.GetState() != WebSocketClientImplCurl::Disconnected)
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    printf("session sharing %-3s  %8.3f ms per TLS handshake\n", sharing ? "on" : "off",
+           total * 1000 / (sharing ? count - 1 : count));
+}
+
+// Close() without kTLS cannot write a close frame, it shuts TLS down at once instead of waiting for the
+// server, which the close timeout left at 0 would do forever. TransportCurlWebSocket runs the handshake.
+static bool CloseCheck(const char* url, WebSocketClientImplCurl::Transport transport, const char* name)
+{
+    BenchClient client;
+    if (!client.SetTransport(transport))
+    {
+        printf("%-36s not supported by this build\n", name);
+        return true;
+    }
+    client.Connect(url);
+    if (!WaitConnected(client))
+    {
+        // libcurl without WebSocket support refuses the ws:// scheme
+        bool ok = transport == WebSocketClientImplCurl::TransportCurlWebSocket;
+        printf("%-36s connect failed%s\n", name, ok ? ", no WebSocket support in libcurl" : "");
+        return ok;
+    }
+    auto begin = std::chrono::steady_clock::now();
+    client.Close();
+    double ms = 0;
+    while (client.GetState() != WebSocketClientImplCurl::Disconnected && ms < 2000)
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+        ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    }
+    bool ok = ms < 100;     // curl would otherwise notice at its next progress check, within a second
+    printf("%-36s %8.3f ms to disconnect   %s\n", name, ms, ok ? "ok" : "failed");
+    return ok;
+}
+
+// GetKernelTlsState() of a connection to the plain @em url, which must not be taken for TLS whatever the
+// transport rewrites the scheme to.
+static bool PlainCheck(const char* url, WebSocketClientImplCurl::Transport transport, const char* name)
+{
+    BenchClient client;
+    if (!client.SetTransport(transport))
+    {
+        printf("%-36s not supported by this build\n", name);
+        return true;
+    }
+    client.Connect(url);
+    if (!WaitConnected(client))
+    {
+        bool ok = transport == WebSocketClientImplCurl::TransportCurlWebSocket;
+        printf("%-36s connect failed%s\n", name, ok ? ", no WebSocket support in libcurl" : "");
+        return ok;
+    }
+    bool send = false, recv = false;
+    bool ok = !client.GetKernelTlsState(&send, &recv) && !send && !recv;
+    printf("%-36s %s\n", name, ok ? "ok" : "failed, reported as TLS");
+    client.Close();
+    while (client.GetState() != WebSocketClientImplCurl::Disconnected)
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    return ok;
+}
+
+static void Push(const char* url, bool ktls, uint64_t bytes)
+{
+    BenchClient client;
+    if (!client.SetKernelTls(ktls))
+    {
+        printf("kTLS %-3s  not supported by this build\n", ktls ? "on" : "off");
+        return;
+    }
+    std::string pushUrl = std::string(url) + "?push=" + std::to_string(bytes);
+    auto begin = std::chrono::steady_clock::now();
+    client.Connect(pushUrl.c_str());
+    if (!WaitConnected(client))
+    {
+        printf("connect failed\n");
+        return;
+    }
+    while (client.received < bytes)
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    bool send = false, recv = false;
+    const char* state = client.GetKernelTlsState(&send, &recv) ?
+        (send && recv ? "send+recv" : send ? "send" : recv ? "recv" : "none") : "unknown";
+    printf("kTLS %-3s  %9.1f MB/s received   kernel TLS: %s\n", ktls ? "on" : "off", bytes / seconds / 1e6, state);
+    client.Close();
+    while (client.GetState() != WebSocketClientImplCurl::Disconnected)
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+}
+
+int main(int argc, char *argv[])
+{
+    const char* url = argc > 1 ? argv[1] : "https://127.0.0.1:8443/ws";
+    int count = argc > 2 ? atoi(argv[2]) : 50;
+    uint64_t bytes = argc > 3 ? strtoull(argv[3], NULL, 10) : 1024ull * 1024 * 1024;
+    const char* plainUrl = argc > 4 ? argv[4] : "http://127.0.0.1:8000/ws";
+
+    printf("%s, %d handshakes, %llu bytes pushed\n", url, count, (unsigned long long)bytes);
+    bool ok = CloseCheck(url, WebSocketClientImplCurl::TransportCurl, "Close(), TLS shut down");
+    ok = CloseCheck(url, WebSocketClientImplCurl::TransportCurlWebSocket, "Close(), close handshake by curl") && ok;
+    ok = PlainCheck(plainUrl, WebSocketClientImplCurl::TransportCurl, "plain url, not TLS") && ok;
+    ok = PlainCheck(plainUrl, WebSocketClientImplCurl::TransportCurlWebSocket, "plain url by curl, not TLS") && ok;
+    Handshakes(url, false, count);
+    Handshakes(url, true, count);
+    Push(url, false, bytes);
+    Push(url, true, bytes);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,77 @@
+#include "WebSocketClientImplCurl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+using namespace ws;
+
+// Records a short echo session with the trace points compiled in, and writes it as a Chrome trace.
+// Build with -DWEBSOCKET_CLIENT_TRACE and run it against test/echo-server.
+
+class TraceClient : public WebSocketClientImplCurl
+{
+public:
+    TraceClient() : connected(false), failed(false), received(0) {}
+    virtual void OnConnect(ConnectResult result) override
+    {
+        if (result == Success)
+            connected = true;
+        else
+            failed = true;
+    }
+    virtual void OnRecv(Message msg, bool fin) override
+    {
+        if (fin)
+            ++received;
+    }
+
+    std::atomic<bool> connected;
+    std::atomic<bool> failed;
+    std::atomic<int> received;
+};
+
+int main(int argc, char *argv[])
+{
+    const char* url = argc > 1 ? argv[1] : "http://127.0.0.1:8000/ws";
+    const char* path = argc > 2 ? argv[2] : "trace.json";
+    int transport = argc > 3 ? atoi(argv[3]) : WebSocketClientImplCurl::TransportSocket;
+    int count = argc > 4 ? atoi(argv[4]) : 1000;
+
+    TraceClient client;
+    client.SetTransport((WebSocketClientImplCurl::Transport)transport);
+    client.Connect(url);
+    while (!client.connected && !client.failed)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    if (client.failed)
+    {
+        printf("connect failed\n");
+        return 1;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    int base = client.received;
+
+    // Mixed sizes, so large messages take partial sends and split chunks.
+    std::string payload(256 * 1024, 'x');
+    for (int i = 0; i < count; ++i)
+    {
+        size_t size = i % 10 == 9 ? payload.size() : 64;
+        int64_t remaining = client.Send(Message(Binary, payload.data(), size));
+        while (remaining > 0)
+            remaining = client.SendRemaining();
+    }
+    while (client.received < base + count)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    client.Close();
+    while (client.GetState() != WebSocketClientImplCurl::Disconnected)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    if (!trace::DumpChromeTrace(path))
+    {
+        printf("no trace written, build with -DWEBSOCKET_CLIENT_TRACE\n");
+        return 1;
+    }
+    printf("%d messages echoed, trace written to %s\n", count, path);
+    return 0;
+}
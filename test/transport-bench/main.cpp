@@ -0,0 +1,110 @@
+#include "WebSocketClientImplCurl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+using namespace ws;
+
+// Echo benchmark of the transports, run it against test/echo-server.
+
+class BenchClient : public WebSocketClientImplCurl
+{
+public:
+    BenchClient() : connected(false), failed(false), received(0) {}
+    virtual void OnConnect(ConnectResult result) override
+    {
+        if (result == Success)
+            connected = true;
+        else
+            failed = true;
+    }
+    virtual void OnRecv(Message msg, bool fin) override
+    {
+        if (fin)
+            ++received;
+    }
+
+    std::atomic<bool> connected;
+    std::atomic<bool> failed;
+    std::atomic<int> received;
+};
+
+static const char* names[] = { "curl", "socket", "io_uring", "io_uring-sqpoll", "curl-websocket" };
+
+static void Run(const char* url, WebSocketClientImplCurl::Transport transport, size_t size, int count, int window)
+{
+    BenchClient client;
+    if (!client.SetTransport(transport))
+    {
+        printf("%-16s not supported by this build or libcurl\n", names[transport]);
+        return;
+    }
+    client.Connect(url);
+    while (!client.connected && !client.failed)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    if (client.failed)
+    {
+        printf("%-16s connect failed\n", names[transport]);
+        return;
+    }
+    // Let the transport take the socket over from curl.
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    std::string payload(size, 'x');
+    WebSocketClientImplCurl::Statistics before = client.GetStatistics();
+    auto begin = std::chrono::steady_clock::now();
+    int sent = 0;
+    while (sent < count)
+    {
+        if (sent - client.received >= window)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        int64_t remaining = client.Send(Message(Binary, payload.data(), payload.size()));
+        while (remaining > 0)
+            remaining = client.SendRemaining();
+        if (remaining < 0)
+        {
+            printf("%-16s send failed\n", names[transport]);
+            return;
+        }
+        ++sent;
+    }
+    while (client.received < count)
+        std::this_thread::yield();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    WebSocketClientImplCurl::Statistics after = client.GetStatistics();
+
+    double sendCalls = (double)(after.sendCalls - before.sendCalls) / count;
+    double recvCalls = (double)(after.recvCalls - before.recvCalls) / count;
+    char recvText[32];
+    if (transport == WebSocketClientImplCurl::TransportCurl)
+        snprintf(recvText, sizeof(recvText), "n/a");
+    else
+        snprintf(recvText, sizeof(recvText), "%.3f", recvCalls);
+    printf("%-16s %10.0f msg/s %9.1f MB/s   send syscalls/msg %.3f   recv syscalls/msg %s\n", names[transport],
+           count / seconds, 2.0 * count * size / seconds / 1e6, sendCalls, recvText);
+
+    client.Close();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+}
+
+int main(int argc, char *argv[])
+{
+    const char* url = argc > 1 ? argv[1] : "http://127.0.0.1:8000/ws";
+    size_t size = argc > 2 ? atoi(argv[2]) : 64;
+    int count = argc > 3 ? atoi(argv[3]) : 200000;
+    int window = argc > 4 ? atoi(argv[4]) : 32;
+
+    printf("%s, %zu bytes per message, %d messages, %d in flight\n", url, size, count, window);
+    for (int transport = WebSocketClientImplCurl::TransportCurl;
+         transport <= WebSocketClientImplCurl::TransportCurlWebSocket; ++transport)
+    {
+        Run(url, (WebSocketClientImplCurl::Transport)transport, size, count, window);
+    }
+    return 0;
+}
@@ -0,0 +1,105 @@
+#include "WebSocketClientImplCurl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace ws;
+
+// Round-trip latency and echo throughput over TCP loopback and a unix domain socket, run it against two
+// instances of test/echo-server, one listening on a port and one on a socket path.
+
+class BenchClient : public WebSocketClientImplCurl
+{
+public:
+    BenchClient() : connected(false), failed(false), received(0) {}
+    virtual void OnConnect(ConnectResult result) override
+    {
+        if (result == Success)
+            connected = true;
+        else
+            failed = true;
+    }
+    virtual void OnRecv(Message msg, bool fin) override
+    {
+        if (fin)
+            ++received;
+    }
+
+    std::atomic<bool> connected;
+    std::atomic<bool> failed;
+    std::atomic<int> received;
+};
+
+static void Run(const char* url, int transport, int rounds, size_t size, int count)
+{
+    BenchClient client;
+    client.SetTransport((WebSocketClientImplCurl::Transport)transport);
+    client.Connect(url);
+    while (!client.connected && !client.failed)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    if (client.failed)
+    {
+        printf("%-32s connect failed\n", url);
+        return;
+    }
+    // Let the transport take the socket over from curl.
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    // Latency: one small message in flight.
+    std::string small(64, 'x');
+    std::vector<double> rtts;
+    for (int i = 0; i < rounds; ++i)
+    {
+        int expected = client.received + 1;
+        auto begin = std::chrono::steady_clock::now();
+        client.Send(Message(Binary, small.data(), small.size()));
+        while (client.received < expected)
+            std::this_thread::yield();
+        rtts.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count());
+    }
+    std::sort(rtts.begin(), rtts.end());
+
+    // Throughput: large messages, up to 8 in flight.
+    std::string payload(size, 'x');
+    int base = client.received;
+    auto begin = std::chrono::steady_clock::now();
+    int sent = 0;
+    while (sent < count)
+    {
+        if (sent - (client.received - base) >= 8 || client.SendRemaining() > 0)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        client.Send(Message(Binary, payload.data(), payload.size()));
+        ++sent;
+    }
+    while (client.received - base < count)
+        std::this_thread::yield();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    printf("%-32s rtt p50 %6.1f us  p99 %6.1f us   echo %8.1f MB/s\n", url, rtts[rtts.size() / 2],
+           rtts[rtts.size() * 99 / 100], 2.0 * count * size / seconds / 1e6);
+    client.Close();
+    while (client.GetState() != WebSocketClientImplCurl::Disconnected)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+int main(int argc, char *argv[])
+{
+    const char* tcpUrl = argc > 1 ? argv[1] : "http://127.0.0.1:8000/ws";
+    const char* unixUrl = argc > 2 ? argv[2] : "ws+unix:///tmp/echo.sock:/ws";
+    int transport = argc > 3 ? atoi(argv[3]) : WebSocketClientImplCurl::TransportSocket;
+    int rounds = argc > 4 ? atoi(argv[4]) : 20000;
+    size_t size = argc > 5 ? atoi(argv[5]) : 65536;
+    int count = argc > 6 ? atoi(argv[6]) : 20000;
+
+    printf("transport %d, %d round trips of 64 bytes, %d echoes of %zu bytes\n", transport, rounds, count, size);
+    Run(tcpUrl, transport, rounds, size, count);
+    Run(unixUrl, transport, rounds, size, count);
+    return 0;
+}